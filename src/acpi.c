@@ -2,12 +2,16 @@
 #include <io.h>
 #include <printf.h>
 #include "csmwrap.h"
+#include "arena.h"
+#include "clock.h"
+#include "pci.h"
 
 #include <uacpi/kernel_api.h>
 #include <uacpi/tables.h>
 #include <uacpi/uacpi.h>
 
 uintptr_t g_rsdp = 0;
+static size_t rsdp_size;
 
 static inline const char *uacpi_log_level_to_string(uacpi_log_level lvl) {
     switch (lvl) {
@@ -37,53 +41,61 @@ void uacpi_kernel_unmap(EFI_UNUSED void *ptr, EFI_UNUSED uacpi_size len) {
 }
 
 uacpi_status uacpi_kernel_pci_device_open(uacpi_pci_address address, uacpi_handle *out_handle) {
-    void *handle;
-    if (gBS->AllocatePool(EfiLoaderData, sizeof(uacpi_pci_address), &handle) != EFI_SUCCESS) {
+    struct pci_device *pdev = pci_find_device(address.segment, address.bus,
+                                              address.device, address.function);
+    if (pdev != NULL) {
+        *out_handle = pdev;
+        return UACPI_STATUS_OK;
+    }
+
+    /* AML may poke at functions that did not respond during the scan */
+    pdev = arena_alloc(sizeof(*pdev));
+    if (pdev == NULL) {
         return UACPI_STATUS_OUT_OF_MEMORY;
     }
 
-    memcpy(handle, &address, sizeof(uacpi_pci_address));
-    *out_handle = handle;
+    memset(pdev, 0, sizeof(*pdev));
+    pdev->seg = address.segment;
+    pdev->bus = address.bus;
+    pdev->dev = address.device;
+    pdev->func = address.function;
+    *out_handle = pdev;
     return UACPI_STATUS_OK;
 }
 
 void uacpi_kernel_pci_device_close(uacpi_handle handle) {
-    gBS->FreePool(handle);
+    if (!pci_is_inventory_device(handle)) {
+        arena_free(handle);
+    }
 }
 
 uacpi_status uacpi_kernel_pci_read8(uacpi_handle device, uacpi_size offset, uacpi_u8 *value) {
-    uacpi_pci_address *address = (uacpi_pci_address *)device;
-    *value = pciConfigReadByte(address->bus, address->device, address->function, offset);
+    *value = pci_dev_read8(device, offset);
     return UACPI_STATUS_OK;
 }
 
 uacpi_status uacpi_kernel_pci_read16(uacpi_handle device, uacpi_size offset, uacpi_u16 *value) {
-    uacpi_pci_address *address = (uacpi_pci_address *)device;
-    *value = pciConfigReadWord(address->bus, address->device, address->function, offset);
+    *value = pci_dev_read16(device, offset);
     return UACPI_STATUS_OK;
 }
 
 uacpi_status uacpi_kernel_pci_read32(uacpi_handle device, uacpi_size offset, uacpi_u32 *value) {
-    uacpi_pci_address *address = (uacpi_pci_address *)device;
-    *value = pciConfigReadDWord(address->bus, address->device, address->function, offset);
+    *value = pci_dev_read32(device, offset);
     return UACPI_STATUS_OK;
 }
 
 uacpi_status uacpi_kernel_pci_write8(uacpi_handle device, uacpi_size offset, uacpi_u8 value) {
-    uacpi_pci_address *address = (uacpi_pci_address *)device;
-    pciConfigWriteByte(address->bus, address->device, address->function, offset, value);
+    pci_dev_write8(device, offset, value);
     return UACPI_STATUS_OK;
 }
 
 uacpi_status uacpi_kernel_pci_write16(uacpi_handle device, uacpi_size offset, uacpi_u16 value) {
-    uacpi_pci_address *address = (uacpi_pci_address *)device;
-    pciConfigWriteWord(address->bus, address->device, address->function, offset, value);
+    pci_dev_write16(device, offset, value);
     return UACPI_STATUS_OK;
 }
 
 uacpi_status uacpi_kernel_pci_write32(uacpi_handle device, uacpi_size offset, uacpi_u32 value) {
-    uacpi_pci_address *address = (uacpi_pci_address *)device;
-    pciConfigWriteDWord(address->bus, address->device, address->function, offset, value);
+    pci_dev_write32(device, offset, value);
     return UACPI_STATUS_OK;
 }
 
@@ -93,21 +105,20 @@ struct mapped_io {
 };
 
 uacpi_status uacpi_kernel_io_map(uacpi_io_addr base, uacpi_size len, uacpi_handle *out_handle) {
-    void *handle;
-    if (gBS->AllocatePool(EfiLoaderData, sizeof(uacpi_pci_address), &handle) != EFI_SUCCESS) {
+    struct mapped_io *io = arena_alloc(sizeof(struct mapped_io));
+    if (io == NULL) {
         return UACPI_STATUS_OUT_OF_MEMORY;
     }
 
-    struct mapped_io *io = (struct mapped_io *)handle;
     io->base = base;
     io->len = len;
 
-    *out_handle = handle;
+    *out_handle = io;
     return UACPI_STATUS_OK;
 }
 
 void uacpi_kernel_io_unmap(uacpi_handle handle) {
-    gBS->FreePool(handle);
+    arena_free(handle);
 }
 
 uacpi_status uacpi_kernel_io_read8(uacpi_handle handle, uacpi_size offset, uacpi_u8 *out_value) {
@@ -170,17 +181,15 @@ uacpi_status uacpi_kernel_io_write32(uacpi_handle handle, uacpi_size offset, uac
     return UACPI_STATUS_OK;
 }
 
-uacpi_handle uacpi_kernel_create_spinlock(void) {
-    void *handle;
-    if (gBS->AllocatePool(EfiLoaderData, 0x1, &handle) != EFI_SUCCESS) {
-        return NULL;
-    }
+/* We are single threaded, locks and events only need a non-NULL handle */
+static uint8_t spinlock_handle, event_handle, mutex_handle;
 
-    return handle;
+uacpi_handle uacpi_kernel_create_spinlock(void) {
+    return &spinlock_handle;
 }
 
 void uacpi_kernel_free_spinlock(uacpi_handle handle) {
-    gBS->FreePool(handle);
+    (void)handle;
 }
 
 uacpi_cpu_flags uacpi_kernel_lock_spinlock(uacpi_handle handle) {
@@ -194,16 +203,11 @@ void uacpi_kernel_unlock_spinlock(uacpi_handle handle, uacpi_cpu_flags cpu_flags
 }
 
 uacpi_handle uacpi_kernel_create_event(void) {
-    void *handle;
-    if (gBS->AllocatePool(EfiLoaderData, 0x1, &handle) != EFI_SUCCESS) {
-        return NULL;
-    }
-
-    return handle;
+    return &event_handle;
 }
 
 void uacpi_kernel_free_event(uacpi_handle handle) {
-    gBS->FreePool(handle);
+    (void)handle;
 }
 
 uacpi_bool uacpi_kernel_wait_for_event(uacpi_handle handle, uacpi_u16 timeout) {
@@ -220,52 +224,16 @@ void uacpi_kernel_reset_event(uacpi_handle handle) {
     (void)handle;
 }
 
-// Borrowed from https://github.com/limine-bootloader/limine/blob/v9.x/common/lib/time.c
-
-static int get_jdn(int days, int months, int years) {
-    return (1461 * (years + 4800 + (months - 14) / 12)) / 4
-        + (367 * (months - 2 - 12 * ((months - 14) / 12))) / 12
-        - (3 * ((years + 4900 + (months - 14) / 12) / 100)) / 4
-        + days - 32075;
-}
-
-#define NS_PER_S UINT64_C(1000000000)
-
-static uint64_t get_unix_epoch(
-        uint16_t nanoseconds, uint8_t seconds, uint8_t minutes, uint8_t hours,
-        uint8_t days, uint8_t months, uint16_t years) {
-    uint64_t jdn_current = get_jdn(days, months, years);
-    uint64_t jdn_1970 = get_jdn(1, 1, 1970);
-    uint64_t jdn_diff = jdn_current - jdn_1970;
-
-    return (jdn_diff * 60 * 60 * 24 * NS_PER_S)
-        + (hours * 3600 * NS_PER_S)
-        + (minutes * 60 * NS_PER_S)
-        + (seconds * NS_PER_S)
-        + nanoseconds;
-}
-
 uacpi_u64 uacpi_kernel_get_nanoseconds_since_boot(void) {
-    EFI_TIME time;
-    if (gRT->GetTime(&time, NULL) != EFI_SUCCESS) {
-        return 0;
-    }
-
-    uint64_t boot_time = get_unix_epoch(
-        gTimeAtBoot.Nanosecond, gTimeAtBoot.Second, gTimeAtBoot.Minute,
-        gTimeAtBoot.Hour, gTimeAtBoot.Day, gTimeAtBoot.Month, gTimeAtBoot.Year);
-    uint64_t current_time = get_unix_epoch(
-        time.Nanosecond, time.Second, time.Minute, time.Hour, time.Day, time.Month, time.Year);
-
-    return current_time - boot_time;
+    return clock_ns();
 }
 
 void uacpi_kernel_stall(uacpi_u8 usec) {
-    gBS->Stall(usec);
+    udelay(usec);
 }
 
 void uacpi_kernel_sleep(uacpi_u64 msec) {
-    gBS->Stall(msec * 1000);
+    udelay(msec * 1000);
 }
 
 uacpi_thread_id uacpi_kernel_get_thread_id(void) {
@@ -305,31 +273,19 @@ uacpi_status uacpi_kernel_wait_for_work_completion(void) {
 }
 
 void *uacpi_kernel_alloc(uacpi_size size) {
-    void *result;
-    if (gBS->AllocatePool(EfiLoaderData, size, &result) != EFI_SUCCESS) {
-        return NULL;
-    }
-
-    return result;
+    return arena_alloc(size);
 }
 
 void uacpi_kernel_free(void *mem) {
-    if (mem != NULL) {
-        gBS->FreePool(mem);
-    }
+    arena_free(mem);
 }
 
 uacpi_handle uacpi_kernel_create_mutex(void) {
-    void *handle;
-    if (gBS->AllocatePool(EfiLoaderData, 0x1, &handle) != EFI_SUCCESS) {
-        return NULL;
-    }
-
-    return handle;
+    return &mutex_handle;
 }
 
 void uacpi_kernel_free_mutex(uacpi_handle handle) {
-    gBS->FreePool(handle);
+    (void)handle;
 }
 
 uacpi_status uacpi_kernel_acquire_mutex(uacpi_handle handle, uacpi_u16 timeout) {
@@ -353,19 +309,18 @@ uacpi_status uacpi_kernel_get_rsdp(uacpi_phys_addr *rsdp) {
 
 static void *early_table_buffer;
 
-bool acpi_init(struct csmwrap_priv *priv) {
+bool acpi_init(void) {
     UINTN i;
     EFI_GUID acpiGuid = ACPI_TABLE_GUID;
     EFI_GUID acpi2Guid = ACPI_20_TABLE_GUID;
-    void *table_target = priv->csm_bin + (priv->csm_efi_table->AcpiRsdPtrPointer - priv->csm_bin_base);
 
     for (i = 0; i < gST->NumberOfTableEntries; i++) {
         EFI_CONFIGURATION_TABLE *table;
         table = gST->ConfigurationTable + i;
 
         if (!efi_guidcmp(table->VendorGuid, acpi2Guid)) {
-            printf("Found ACPI 2.0 RSDT at %x, copied to %x\n", (uintptr_t)table->VendorTable, (uintptr_t)table_target);
-            memcpy(table_target, table->VendorTable, sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+            printf_verbose("Found ACPI 2.0 RSDT at %lx\n", (unsigned long)(uintptr_t)table->VendorTable);
+            rsdp_size = sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER);
             g_rsdp = (uintptr_t)table->VendorTable;
             break;
         }
@@ -377,8 +332,8 @@ bool acpi_init(struct csmwrap_priv *priv) {
             table = gST->ConfigurationTable + i;
 
             if (!efi_guidcmp(table->VendorGuid, acpiGuid)) {
-                printf("Found ACPI 1.0 RSDT at %x, copied to %x\n", (uintptr_t)table->VendorTable, (uintptr_t)table_target);
-                memcpy(table_target, table->VendorTable, sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
+                printf_verbose("Found ACPI 1.0 RSDT at %lx\n", (unsigned long)(uintptr_t)table->VendorTable);
+                rsdp_size = sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER);
                 g_rsdp = (uintptr_t)table->VendorTable;
                 break;
             }
@@ -406,6 +361,15 @@ bool acpi_init(struct csmwrap_priv *priv) {
     return false;
 }
 
+/* Copy RSD PTR into the slot reserved for it in the decompressed CSM16 image */
+void acpi_install_rsdp(struct csmwrap_priv *priv) {
+    if (g_rsdp == 0) {
+        return;
+    }
+
+    memcpy((void *)(uintptr_t)priv->csm_efi_table->AcpiRsdPtrPointer, (void *)g_rsdp, rsdp_size);
+}
+
 static bool fully_initialized = false;
 
 bool acpi_full_init(void) {
@@ -444,6 +408,8 @@ void acpi_prepare_exitbs(void) {
         uacpi_state_reset();
     }
 
+    arena_print_stats();
+
     if (early_table_buffer != NULL) {
         gBS->FreePool(early_table_buffer);
         early_table_buffer = NULL;
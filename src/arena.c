@@ -0,0 +1,137 @@
+/*
+ * Small-object allocator for uACPI.
+ *
+ * A namespace load does tens of thousands of small allocations, going to
+ * AllocatePool() for each of them is slow and fragments the firmware heap.
+ * Blocks are carved from large page allocations instead and recycled
+ * through per size class free lists. Anything bigger than the largest
+ * class still goes to the firmware.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE    0x10000
+#define ARENA_MIN_SHIFT     4       /* 16 bytes */
+#define ARENA_MAX_SHIFT     11      /* 2 KiB */
+#define ARENA_CLASSES       (ARENA_MAX_SHIFT - ARENA_MIN_SHIFT + 1)
+#define ARENA_LARGE         0xffffffff
+
+/* Sits in front of every block, keeps the payload 16 byte aligned */
+struct arena_header {
+    uint32_t size_class;
+    uint32_t size;
+    uint64_t reserved;
+};
+
+struct arena_free_block {
+    struct arena_free_block *next;
+};
+
+static struct arena_free_block *free_lists[ARENA_CLASSES];
+static uint8_t *chunk_cur;
+static uint8_t *chunk_end;
+
+static struct {
+    size_t chunks;
+    size_t allocs;
+    size_t large_allocs;
+    size_t in_use;
+    size_t peak;
+} stats;
+
+static uint32_t size_to_class(size_t size)
+{
+    uint32_t class = 0;
+
+    while (((size_t)1 << (class + ARENA_MIN_SHIFT)) < size) {
+        class++;
+    }
+    return class;
+}
+
+static void *arena_carve(size_t block_size)
+{
+    if (chunk_cur == NULL || (size_t)(chunk_end - chunk_cur) < block_size) {
+        EFI_PHYSICAL_ADDRESS addr;
+
+        /* The tail of the old chunk is lost, it is smaller than one block anyway */
+        if (gBS->AllocatePages(AllocateAnyPages, EfiLoaderData,
+                               ARENA_CHUNK_SIZE / EFI_PAGE_SIZE, &addr) != EFI_SUCCESS) {
+            return NULL;
+        }
+
+        chunk_cur = (uint8_t *)(uintptr_t)addr;
+        chunk_end = chunk_cur + ARENA_CHUNK_SIZE;
+        stats.chunks++;
+    }
+
+    void *block = chunk_cur;
+    chunk_cur += block_size;
+    return block;
+}
+
+void *arena_alloc(size_t size)
+{
+    size_t total = size + sizeof(struct arena_header);
+    struct arena_header *header;
+
+    if (total > ((size_t)1 << ARENA_MAX_SHIFT)) {
+        if (gBS->AllocatePool(EfiLoaderData, total, (void **)&header) != EFI_SUCCESS) {
+            return NULL;
+        }
+        header->size_class = ARENA_LARGE;
+        stats.large_allocs++;
+    } else {
+        uint32_t class = size_to_class(total);
+
+        if (free_lists[class] != NULL) {
+            header = (struct arena_header *)free_lists[class];
+            free_lists[class] = free_lists[class]->next;
+        } else {
+            header = arena_carve((size_t)1 << (class + ARENA_MIN_SHIFT));
+            if (header == NULL) {
+                return NULL;
+            }
+        }
+        header->size_class = class;
+    }
+
+    header->size = size;
+    stats.allocs++;
+    stats.in_use += size;
+    if (stats.in_use > stats.peak) {
+        stats.peak = stats.in_use;
+    }
+
+    return header + 1;
+}
+
+void arena_free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    struct arena_header *header = (struct arena_header *)ptr - 1;
+    stats.in_use -= header->size;
+
+    if (header->size_class == ARENA_LARGE) {
+        gBS->FreePool(header);
+        return;
+    }
+
+    /* The link overwrites the header */
+    uint32_t class = header->size_class;
+    struct arena_free_block *block = (struct arena_free_block *)header;
+    block->next = free_lists[class];
+    free_lists[class] = block;
+}
+
+void arena_print_stats(void)
+{
+    printf_verbose("Arena: %u allocations (%u large), %u chunks, peak %u bytes, %u bytes in use\n",
+                   (uint32_t)stats.allocs, (uint32_t)stats.large_allocs, (uint32_t)stats.chunks,
+                   (uint32_t)stats.peak, (uint32_t)stats.in_use);
+}
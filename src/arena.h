@@ -0,0 +1,10 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+void *arena_alloc(size_t size);
+void arena_free(void *ptr);
+void arena_print_stats(void);
+
+#endif
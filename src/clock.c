@@ -0,0 +1,218 @@
+/*
+ * TSC based monotonic clock.
+ *
+ * The TSC is calibrated once, from CPUID when the CPU tells us its
+ * frequency, otherwise against the ACPI PM timer or PIT channel 2.
+ * After that timekeeping is just rdtsc, which keeps working after
+ * ExitBootServices.
+ */
+
+#include <stddef.h>
+#include <efi.h>
+#include "csmwrap.h"
+#include "clock.h"
+#include "io.h"
+#include "pit.h"
+
+#include <uacpi/tables.h>
+
+#define PM_TIMER_HZ         3579545
+/* FADT flag for a 32-bit PM timer, instead of 24-bit */
+#define FADT_TMR_VAL_EXT    (1 << 8)
+/* Calibration window for the measured sources */
+#define CALIBRATE_MS        10
+/* Give up on a timer that never advances */
+#define CALIBRATE_POLL_LIMIT 1000000
+
+static uint64_t tsc_hz;
+static uint64_t tsc_base;
+static uint32_t crystal_hz;
+
+/* Leaf 15h, TSC/crystal ratio and crystal frequency */
+static uint64_t tsc_hz_from_cpuid_15h(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (cpuid_max_leaf() < 0x15) {
+        return 0;
+    }
+
+    cpuid(0x15, 0, &eax, &ebx, &ecx, &edx);
+    if (eax == 0 || ebx == 0) {
+        return 0;
+    }
+
+    /* Some parts report the ratio only, derive the crystal from the base frequency */
+    if (ecx == 0 && cpuid_max_leaf() >= 0x16) {
+        uint32_t base_mhz, unused;
+
+        cpuid(0x16, 0, &base_mhz, &unused, &unused, &unused);
+        ecx = (uint64_t)(base_mhz & 0xffff) * 1000000 * eax / ebx;
+    }
+    if (ecx == 0) {
+        return 0;
+    }
+
+    crystal_hz = ecx;
+    return (uint64_t)ecx * ebx / eax;
+}
+
+/* Leaf 16h, processor base frequency */
+static uint64_t tsc_hz_from_cpuid_16h(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (cpuid_max_leaf() < 0x16) {
+        return 0;
+    }
+
+    cpuid(0x16, 0, &eax, &ebx, &ecx, &edx);
+    return (uint64_t)(eax & 0xffff) * 1000000;
+}
+
+static uint16_t pm_timer_port(uint32_t *mask)
+{
+    EFI_ACPI_2_0_FIXED_ACPI_DESCRIPTION_TABLE *fadt;
+    uacpi_table table;
+    uint16_t port = 0;
+
+    if (uacpi_table_find_by_signature("FACP", &table) != UACPI_STATUS_OK) {
+        return 0;
+    }
+
+    fadt = table.ptr;
+    if (fadt->PmTmrBlk != 0) {
+        port = fadt->PmTmrBlk;
+    } else if (fadt->Header.Length >= offsetof(EFI_ACPI_2_0_FIXED_ACPI_DESCRIPTION_TABLE, XPmTmrBlk) +
+                                       sizeof(fadt->XPmTmrBlk) &&
+               fadt->XPmTmrBlk.AddressSpaceId == EFI_ACPI_2_0_SYSTEM_IO) {
+        port = fadt->XPmTmrBlk.Address;
+    }
+    *mask = (fadt->Flags & FADT_TMR_VAL_EXT) ? 0xffffffff : 0xffffff;
+
+    uacpi_table_unref(&table);
+    return port;
+}
+
+static uint64_t tsc_hz_from_pm_timer(void)
+{
+    uint32_t mask;
+    uint16_t port = pm_timer_port(&mask);
+    const uint32_t ticks = PM_TIMER_HZ / 1000 * CALIBRATE_MS;
+
+    if (port == 0) {
+        return 0;
+    }
+
+    uint32_t start = inl(port) & mask;
+    uint64_t tsc_start = rdtsc();
+    uint32_t elapsed = 0;
+
+    for (int i = 0; i < CALIBRATE_POLL_LIMIT && elapsed < ticks; i++) {
+        elapsed = ((inl(port) & mask) - start) & mask;
+    }
+    uint64_t tsc_end = rdtsc();
+
+    if (elapsed < ticks) {
+        return 0;
+    }
+
+    return (tsc_end - tsc_start) * PM_TIMER_HZ / elapsed;
+}
+
+/* One-shot countdown on channel 2, OUT goes high when it reaches zero */
+static uint64_t tsc_hz_from_pit(void)
+{
+    const uint16_t latch = PIT_HZ / 1000 * CALIBRATE_MS;
+    uint8_t ctrlb = inb(PORT_PS2_CTRLB);
+    bool done = false;
+
+    /* Gate on, speaker off */
+    outb(PORT_PS2_CTRLB, (ctrlb & ~PPCB_SPKR) | PPCB_T2GATE);
+    outb(PORT_PIT_MODE, PM_SEL_TIMER2 | PM_ACCESS_WORD | PM_MODE0 | PM_CNT_BINARY);
+    outb(PORT_PIT_COUNTER2, latch & 0xff);
+    outb(PORT_PIT_COUNTER2, latch >> 8);
+
+    uint64_t tsc_start = rdtsc();
+    for (int i = 0; i < CALIBRATE_POLL_LIMIT; i++) {
+        if (inb(PORT_PS2_CTRLB) & PPCB_T2OUT) {
+            done = true;
+            break;
+        }
+    }
+    uint64_t tsc_end = rdtsc();
+
+    outb(PORT_PS2_CTRLB, ctrlb);
+
+    if (!done) {
+        return 0;
+    }
+
+    return (tsc_end - tsc_start) * PIT_HZ / latch;
+}
+
+/* Last resort, needs boot services */
+static uint64_t tsc_hz_from_stall(void)
+{
+    uint64_t tsc_start = rdtsc();
+
+    gBS->Stall(CALIBRATE_MS * 1000);
+    return (rdtsc() - tsc_start) * 1000 / CALIBRATE_MS;
+}
+
+void clock_init(void)
+{
+    const char *source;
+
+    tsc_base = rdtsc();
+
+    if ((tsc_hz = tsc_hz_from_cpuid_15h()) != 0) {
+        source = "CPUID 15h";
+    } else if ((tsc_hz = tsc_hz_from_cpuid_16h()) != 0) {
+        source = "CPUID 16h";
+    } else if ((tsc_hz = tsc_hz_from_pm_timer()) != 0) {
+        source = "ACPI PM timer";
+    } else if ((tsc_hz = tsc_hz_from_pit()) != 0) {
+        source = "PIT";
+    } else {
+        tsc_hz = tsc_hz_from_stall();
+        source = "Stall()";
+    }
+
+    printf_verbose("TSC: %u kHz (%s)\n", (uint32_t)(tsc_hz / 1000), source);
+    if (crystal_hz != 0) {
+        printf_verbose("Crystal: %u Hz\n", crystal_hz);
+    }
+}
+
+uint64_t clock_tsc_hz(void)
+{
+    return tsc_hz;
+}
+
+uint32_t clock_crystal_hz(void)
+{
+    return crystal_hz;
+}
+
+/* Nanoseconds since clock_init() */
+uint64_t clock_ns(void)
+{
+    uint64_t ticks = rdtsc() - tsc_base;
+
+    if (tsc_hz == 0) {
+        return 0;
+    }
+
+    /* Split to avoid overflowing ticks * 10^9 */
+    return ticks / tsc_hz * 1000000000 + (ticks % tsc_hz) * 1000000000 / tsc_hz;
+}
+
+void udelay(uint64_t us)
+{
+    uint64_t end = rdtsc() + us * tsc_hz / 1000000;
+
+    while (rdtsc() < end) {
+        asm volatile ("pause");
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+void clock_init(void);
+uint64_t clock_tsc_hz(void);
+uint32_t clock_crystal_hz(void);
+uint64_t clock_ns(void);
+void udelay(uint64_t us);
+
+#endif
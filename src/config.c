@@ -0,0 +1,227 @@
+/*
+ * Runtime options passed on the command line of the EFI image, e.g.
+ *   csmwrap.efi verbose
+ *   csmwrap.efi loglevel=2 serial=0x2f8 baud=115200 debugcon=off
+ *   csmwrap.efi romprobe=full
+ * Options are separated by spaces, unknown ones are ignored.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "config.h"
+#include "console.h"
+
+#define CONFIG_MAX_LENGTH   512
+
+struct csmwrap_config gConfig = {
+    .log_level = LOG_INFO,
+    .serial_port = 0x3f8,
+    .serial_baud = 0,
+    .debugcon = true,
+    .fb_wc = true,
+    .rom_lock = true,
+    .rom_probe_full = false,
+    .perf_policy = PERF_POLICY_FIRMWARE,
+    .ap_park = true,
+    .iommu_off = true,
+    .aspm_policy = ASPM_POLICY_FIRMWARE,
+    .mps_policy = MPS_POLICY_FIRMWARE,
+    .quiesce = true,
+};
+
+static bool str_equal(const char *a, const char *b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/* Match "key=" at the start of opt and return the value, or NULL */
+static const char *option_value(const char *opt, const char *key)
+{
+    while (*key) {
+        if (*opt++ != *key++) {
+            return NULL;
+        }
+    }
+    return *opt == '=' ? opt + 1 : NULL;
+}
+
+/* Decimal, or hex with a 0x prefix */
+static bool parse_number(const char *str, uint64_t *out)
+{
+    uint64_t val = 0;
+    unsigned base = 10;
+
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        str += 2;
+    }
+    if (*str == 0) {
+        return false;
+    }
+
+    for (; *str; str++) {
+        unsigned digit;
+
+        if (*str >= '0' && *str <= '9') {
+            digit = *str - '0';
+        } else if (base == 16 && *str >= 'a' && *str <= 'f') {
+            digit = *str - 'a' + 10;
+        } else if (base == 16 && *str >= 'A' && *str <= 'F') {
+            digit = *str - 'A' + 10;
+        } else {
+            return false;
+        }
+        val = val * base + digit;
+    }
+
+    *out = val;
+    return true;
+}
+
+static bool parse_bool(const char *str, bool *out)
+{
+    if (str_equal(str, "on") || str_equal(str, "1")) {
+        *out = true;
+    } else if (str_equal(str, "off") || str_equal(str, "0")) {
+        *out = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void parse_option(const char *opt)
+{
+    const char *val;
+
+    if (str_equal(opt, "verbose")) {
+        gConfig.log_level = LOG_VERBOSE;
+    } else if (str_equal(opt, "debug")) {
+        gConfig.log_level = LOG_DEBUG;
+    } else if ((val = option_value(opt, "loglevel")) != NULL) {
+        if (str_equal(val, "info") || str_equal(val, "0")) {
+            gConfig.log_level = LOG_INFO;
+        } else if (str_equal(val, "verbose") || str_equal(val, "1")) {
+            gConfig.log_level = LOG_VERBOSE;
+        } else if (str_equal(val, "debug") || str_equal(val, "2")) {
+            gConfig.log_level = LOG_DEBUG;
+        } else {
+            printf("Unknown loglevel '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "serial")) != NULL) {
+        uint64_t port;
+        if (str_equal(val, "off")) {
+            gConfig.serial_port = 0;
+        } else if (parse_number(val, &port) && port <= 0xfff8) {
+            gConfig.serial_port = port;
+        } else {
+            printf("Invalid serial port '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "baud")) != NULL) {
+        uint64_t baud;
+        /* The divisor must fit 16 bits and hit the rate exactly */
+        if (parse_number(val, &baud) && baud >= 2 && baud <= UART_CLOCK && UART_CLOCK % baud == 0) {
+            gConfig.serial_baud = baud;
+        } else {
+            printf("Invalid baud rate '%s', must divide %u\n", val, UART_CLOCK);
+        }
+    } else if ((val = option_value(opt, "debugcon")) != NULL) {
+        if (!parse_bool(val, &gConfig.debugcon)) {
+            printf("Invalid debugcon setting '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "fbwc")) != NULL) {
+        if (!parse_bool(val, &gConfig.fb_wc)) {
+            printf("Invalid fbwc setting '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "romlock")) != NULL) {
+        if (!parse_bool(val, &gConfig.rom_lock)) {
+            printf("Invalid romlock setting '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "romprobe")) != NULL) {
+        if (str_equal(val, "full")) {
+            gConfig.rom_probe_full = true;
+        } else if (str_equal(val, "edges")) {
+            gConfig.rom_probe_full = false;
+        } else {
+            printf("Unknown romprobe mode '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "perf")) != NULL) {
+        if (str_equal(val, "firmware")) {
+            gConfig.perf_policy = PERF_POLICY_FIRMWARE;
+        } else if (str_equal(val, "max")) {
+            gConfig.perf_policy = PERF_POLICY_MAX;
+        } else if (str_equal(val, "turbo")) {
+            gConfig.perf_policy = PERF_POLICY_TURBO;
+        } else {
+            printf("Unknown perf policy '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "appark")) != NULL) {
+        if (!parse_bool(val, &gConfig.ap_park)) {
+            printf("Invalid appark setting '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "iommuoff")) != NULL) {
+        if (!parse_bool(val, &gConfig.iommu_off)) {
+            printf("Invalid iommuoff setting '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "aspm")) != NULL) {
+        if (str_equal(val, "firmware")) {
+            gConfig.aspm_policy = ASPM_POLICY_FIRMWARE;
+        } else if (str_equal(val, "performance")) {
+            gConfig.aspm_policy = ASPM_POLICY_PERFORMANCE;
+        } else if (str_equal(val, "l1")) {
+            gConfig.aspm_policy = ASPM_POLICY_L1;
+        } else {
+            printf("Unknown aspm policy '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "mps")) != NULL) {
+        if (str_equal(val, "firmware")) {
+            gConfig.mps_policy = MPS_POLICY_FIRMWARE;
+        } else if (str_equal(val, "tune")) {
+            gConfig.mps_policy = MPS_POLICY_TUNE;
+        } else if (str_equal(val, "dryrun")) {
+            gConfig.mps_policy = MPS_POLICY_DRY_RUN;
+        } else {
+            printf("Unknown mps policy '%s'\n", val);
+        }
+    } else if ((val = option_value(opt, "quiesce")) != NULL) {
+        if (!parse_bool(val, &gConfig.quiesce)) {
+            printf("Invalid quiesce setting '%s'\n", val);
+        }
+    }
+}
+
+void config_init(EFI_HANDLE ImageHandle)
+{
+    EFI_GUID loaded_image_guid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+    EFI_LOADED_IMAGE_PROTOCOL *loaded_image;
+    char buf[CONFIG_MAX_LENGTH];
+    size_t len = 0;
+
+    if (gBS->HandleProtocol(ImageHandle, &loaded_image_guid, (void **)&loaded_image) != EFI_SUCCESS ||
+        loaded_image->LoadOptions == NULL) {
+        return;
+    }
+
+    /* LoadOptions is a UCS-2 string, anything outside ASCII can't be a valid option */
+    CHAR16 *opts = loaded_image->LoadOptions;
+    size_t opts_len = loaded_image->LoadOptionsSize / sizeof(CHAR16);
+    for (size_t i = 0; i < opts_len && opts[i] != 0 && len < sizeof(buf) - 1; i++) {
+        buf[len++] = opts[i] < 0x80 ? (char)opts[i] : '?';
+    }
+    buf[len] = 0;
+
+    char *opt = buf;
+    for (size_t i = 0; i <= len; i++) {
+        if (buf[i] == ' ' || buf[i] == '\t' || buf[i] == 0) {
+            buf[i] = 0;
+            if (*opt) {
+                parse_option(opt);
+            }
+            opt = &buf[i + 1];
+        }
+    }
+}
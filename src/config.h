@@ -0,0 +1,66 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <efi.h>
+
+enum log_level {
+    LOG_INFO,       /* Boot progress and errors, the default */
+    LOG_VERBOSE,    /* Platform details and warnings */
+    LOG_DEBUG,      /* Everything, including DEBUG_VERBOSE dumps */
+};
+
+enum perf_policy {
+    PERF_POLICY_FIRMWARE,   /* Leave P-states as firmware set them, the default */
+    PERF_POLICY_MAX,        /* Highest non-turbo P-state */
+    PERF_POLICY_TURBO,      /* Highest P-state including turbo */
+};
+
+enum aspm_policy {
+    ASPM_POLICY_FIRMWARE,       /* Leave link power management alone, the default */
+    ASPM_POLICY_PERFORMANCE,    /* ASPM, L1 substates and CLKREQ# off */
+    ASPM_POLICY_L1,             /* Like performance, but keep L1 where firmware enabled it */
+};
+
+enum mps_policy {
+    MPS_POLICY_FIRMWARE,    /* Leave MPS/MRRS alone, the default */
+    MPS_POLICY_TUNE,        /* Largest MPS each root port hierarchy supports */
+    MPS_POLICY_DRY_RUN,     /* Only print what tune would program */
+};
+
+/* Runtime options, parsed from the image LoadOptions */
+struct csmwrap_config {
+    enum log_level log_level;
+
+    /* 16550 UART used after ExitBootServices, 0 to disable */
+    uint16_t serial_port;
+    /* Reprogram the UART to this rate, 0 keeps the firmware setup */
+    uint32_t serial_baud;
+    /* Log to the QEMU/Bochs debug console if present */
+    bool debugcon;
+    /* Map the SeaVGABIOS framebuffer write-combining */
+    bool fb_wc;
+    /* Write-protect the shadowed ROMs after Legacy16PrepareToBoot */
+    bool rom_lock;
+    /* Test every dword of the BIOS region when unlocking, not just segment edges */
+    bool rom_probe_full;
+    /* P-state, EPB and C1E policy applied on every CPU before handoff */
+    enum perf_policy perf_policy;
+    /* Put the APs in wait-for-SIPI after ExitBootServices */
+    bool ap_park;
+    /* Turn off VT-d/AMD-Vi remapping before the Legacy16 calls */
+    bool iommu_off;
+    /* PCIe ASPM/L1 substates/CLKREQ# policy applied to every link */
+    enum aspm_policy aspm_policy;
+    /* PCIe Max Payload Size/Max Read Request Size tuning */
+    enum mps_policy mps_policy;
+    /* Hand USB to the OS and stop UEFI-started DMA before SeaBIOS runs */
+    bool quiesce;
+};
+
+extern struct csmwrap_config gConfig;
+
+void config_init(EFI_HANDLE ImageHandle);
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * Console output sinks for printf.
+ *
+ * Everything goes into a CBMEM console ring in reserved memory, which
+ * payloads and Linux (memconsole-coreboot) can read back after boot.
+ * While boot services are around it is also sent to ConOut, afterwards
+ * to a 16550 UART. The QEMU/Bochs debug console gets it all along.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "console.h"
+#include "io.h"
+
+#define CBMEM_CONSOLE_SIZE      0x10000
+#define CBMC_CURSOR_MASK        ((1u << 28) - 1)
+#define CBMC_OVERFLOW           (1u << 31)
+
+/*
+ * Every OutputString() call is a full trip through the console stack,
+ * possibly ending up on a redirected serial port. Collect output and
+ * hand it over a line (or a buffer) at a time.
+ */
+#define CONOUT_BUFFER_SIZE      160
+
+static CHAR16 conout_buf[CONOUT_BUFFER_SIZE + 1];
+static size_t conout_len;
+static bool conout_enabled = true;
+
+static struct cbmem_console *cbmem_console;
+
+#define DEBUGCON_PORT           0xe9
+
+static bool debugcon_enabled;
+
+#define UART_THR                0   /* Transmit holding register */
+#define UART_DLL                0   /* Divisor latch, low */
+#define UART_DLM                1   /* Divisor latch, high */
+#define UART_IER                1   /* Interrupt enable register */
+#define UART_FCR                2   /* FIFO control register */
+#define UART_IIR                2   /* Interrupt identification register */
+#define UART_LCR                3   /* Line control register */
+#define UART_LSR                5   /* Line status register */
+#define UART_SCR                7   /* Scratch register */
+
+#define UART_LCR_8N1            0x03
+#define UART_LCR_DLAB           0x80
+#define UART_FCR_ENABLE_CLEAR   0x07
+#define UART_IIR_FIFO_ENABLED   0xc0
+#define UART_LSR_THRE           0x20
+#define UART_FIFO_SIZE          16
+/* Don't hang on a UART that never drains */
+#define UART_POLL_LIMIT         100000
+
+static bool uart_enabled;
+static uint16_t uart_port;
+static uint8_t uart_fifo_size;
+static uint8_t uart_fifo_used;
+
+/* QEMU and Bochs read back the port number on the debug console port */
+static bool debugcon_detect(void)
+{
+    return inb(DEBUGCON_PORT) == DEBUGCON_PORT;
+}
+
+static bool uart_detect(uint16_t port)
+{
+    uint8_t scratch = inb(port + UART_SCR);
+    bool present;
+
+    outb(port + UART_SCR, 0x5a);
+    present = inb(port + UART_SCR) == 0x5a && inb(port + UART_LSR) != 0xff;
+    outb(port + UART_SCR, scratch);
+
+    return present;
+}
+
+static void uart_wait_empty(void)
+{
+    for (int i = 0; i < UART_POLL_LIMIT; i++) {
+        if (inb(uart_port + UART_LSR) & UART_LSR_THRE) {
+            break;
+        }
+    }
+    uart_fifo_used = 0;
+}
+
+/* Read back the divisor latch, whether we programmed it or firmware did */
+static uint32_t uart_get_baud(uint16_t port)
+{
+    uint8_t lcr = inb(port + UART_LCR);
+    uint16_t divisor;
+
+    outb(port + UART_LCR, lcr | UART_LCR_DLAB);
+    divisor = inb(port + UART_DLL) | inb(port + UART_DLM) << 8;
+    outb(port + UART_LCR, lcr);
+
+    return divisor ? UART_CLOCK / divisor : 0;
+}
+
+static void uart_start(uint16_t port)
+{
+    uart_port = port;
+    uart_wait_empty();
+
+    /* config.c only accepts rates that divide UART_CLOCK exactly */
+    if (gConfig.serial_baud != 0) {
+        uint16_t divisor = UART_CLOCK / gConfig.serial_baud;
+
+        outb(port + UART_IER, 0);
+        outb(port + UART_LCR, UART_LCR_DLAB);
+        outb(port + UART_DLL, divisor & 0xff);
+        outb(port + UART_DLM, divisor >> 8);
+        outb(port + UART_LCR, UART_LCR_8N1);
+    }
+
+    outb(port + UART_FCR, UART_FCR_ENABLE_CLEAR);
+    /* A plain 8250/16450 has no FIFO, wait for every byte there */
+    if ((inb(port + UART_IIR) & UART_IIR_FIFO_ENABLED) == UART_IIR_FIFO_ENABLED) {
+        uart_fifo_size = UART_FIFO_SIZE;
+    } else {
+        uart_fifo_size = 1;
+    }
+
+    uart_enabled = true;
+}
+
+/* Only poll the line status once we may have filled the FIFO */
+static void uart_putc(char c)
+{
+    if (uart_fifo_used >= uart_fifo_size) {
+        uart_wait_empty();
+    }
+    outb(uart_port + UART_THR, c);
+    uart_fifo_used++;
+}
+
+void console_init(void)
+{
+    EFI_PHYSICAL_ADDRESS addr = 0xffffffff;
+
+    debugcon_enabled = gConfig.debugcon && debugcon_detect();
+
+    /* Payloads read it after we are gone, keep it reserved and below 4G */
+    if (gBS->AllocatePages(AllocateMaxAddress, EfiReservedMemoryType,
+                           CBMEM_CONSOLE_SIZE / EFI_PAGE_SIZE, &addr) != EFI_SUCCESS) {
+        printf("Unable to alloc CBMEM console\n");
+        return;
+    }
+
+    cbmem_console = (struct cbmem_console *)(uintptr_t)addr;
+    cbmem_console->size = CBMEM_CONSOLE_SIZE - sizeof(struct cbmem_console);
+    cbmem_console->cursor = 0;
+}
+
+static void cbmem_console_putc(char c)
+{
+    uint32_t cursor = cbmem_console->cursor & CBMC_CURSOR_MASK;
+    uint32_t flags = cbmem_console->cursor & ~CBMC_CURSOR_MASK;
+
+    cbmem_console->body[cursor++] = c;
+    if (cursor >= cbmem_console->size) {
+        /* Wrap around, readers then take the whole buffer starting at cursor */
+        cursor = 0;
+        flags |= CBMC_OVERFLOW;
+    }
+    cbmem_console->cursor = cursor | flags;
+}
+
+void console_flush(void)
+{
+    if (conout_len == 0) {
+        return;
+    }
+
+    conout_buf[conout_len] = 0;
+    conout_len = 0;
+
+    if (!gST->ConOut || !gST->ConOut->OutputString) {
+        /* No console output available */
+        return;
+    }
+
+    gST->ConOut->OutputString(gST->ConOut, conout_buf);
+}
+
+void console_putc(char c)
+{
+    if (cbmem_console != NULL) {
+        cbmem_console_putc(c);
+    }
+
+    if (debugcon_enabled) {
+        outb(DEBUGCON_PORT, c);
+    }
+
+    if (uart_enabled) {
+        if (c == '\n') {
+            uart_putc('\r');
+        }
+        uart_putc(c);
+    }
+
+    if (!conout_enabled) {
+        return;
+    }
+
+    /* Keep room for the \r of a \n */
+    if (conout_len >= CONOUT_BUFFER_SIZE - 1) {
+        console_flush();
+    }
+
+    if (c == '\n') {
+        conout_buf[conout_len++] = '\r';
+    }
+    conout_buf[conout_len++] = (uint8_t)c;
+
+    if (c == '\n') {
+        console_flush();
+    }
+}
+
+/*
+ * ConOut belongs to boot services, stop touching it once they are gone.
+ * The firmware may be driving the UART for ConOut too, so we only take
+ * it over from here on.
+ */
+void console_exit_boot_services(void)
+{
+    conout_len = 0;
+    conout_enabled = false;
+
+    if (gConfig.serial_port != 0 && uart_detect(gConfig.serial_port)) {
+        uart_start(gConfig.serial_port);
+        printf_verbose("Serial: 16550 at 0x%x, %u baud\n",
+                       gConfig.serial_port, uart_get_baud(gConfig.serial_port));
+    }
+}
+
+struct cbmem_console *console_get_cbmem(void)
+{
+    return cbmem_console;
+}
@@ -0,0 +1,16 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+#include <edk2/Coreboot.h>
+
+/* 16550 input clock / 16, the rate for a divisor of 1 */
+#define UART_CLOCK  115200
+
+void console_init(void);
+void console_putc(char c);
+void console_flush(void);
+void console_exit_boot_services(void);
+struct cbmem_console *console_get_cbmem(void);
+
+#endif
@@ -1,5 +1,8 @@
 #include <efi.h>
 #include "csmwrap.h"
+#include "console.h"
+#include "clock.h"
+#include "timestamp.h"
 
 static UINT16
 CbCheckSum16 (
@@ -54,6 +57,66 @@ int build_coreboot_table(struct csmwrap_priv *priv)
             table_entries++;
         }
 
+        /* cb_timestamps, filled in until we jump to Legacy16Boot */
+        struct timestamp_table *ts_table = timestamp_get_table();
+        if (ts_table != NULL) {
+            struct cb_cbmem_ref *timestamps = (struct cb_cbmem_ref *)p;
+            timestamps->tag = CB_TAG_TIMESTAMPS;
+            timestamps->size = sizeof(struct cb_cbmem_ref);
+            timestamps->cbmem_addr = (uintptr_t)ts_table;
+            p += timestamps->size;
+            table_entries++;
+        }
+
+        /* cb_tsc_info, saves payloads from calibrating against a possibly gated PIT */
+        uint64_t tsc_hz = clock_tsc_hz();
+        if (tsc_hz != 0) {
+            struct cb_tsc_info *tsc_info = (struct cb_tsc_info *)p;
+            tsc_info->tag = CB_TAG_TSC_INFO;
+            tsc_info->size = sizeof(struct cb_tsc_info);
+            tsc_info->freq_khz = (uint32_t)(tsc_hz / 1000);
+            p += tsc_info->size;
+            table_entries++;
+        }
+
+        /* cb_cbmem_console, keeps logging after ExitBootServices */
+        struct cbmem_console *console = console_get_cbmem();
+        if (console != NULL) {
+            struct cb_cbmem_ref *cbmem_console = (struct cb_cbmem_ref *)p;
+            cbmem_console->tag = CB_TAG_CBMEM_CONSOLE;
+            cbmem_console->size = sizeof(struct cb_cbmem_ref);
+            cbmem_console->cbmem_addr = (uintptr_t)console;
+            p += cbmem_console->size;
+            table_entries++;
+        }
+
+        /* cb_memory goes last, it may only use what is left below CONVEN_START */
+        /* E820 types match the coreboot ones 1:1 */
+        if (priv->e820_entries != 0) {
+            struct cb_memory *memory = (struct cb_memory *)p;
+            size_t max_ranges = (CONVEN_START - (uintptr_t)p - sizeof(struct cb_memory)) /
+                                sizeof(struct cb_memory_range);
+            size_t ranges = priv->e820_entries;
+
+            if (ranges > max_ranges) {
+                printf("coreboot table: truncating memory map to %u entries\n", (uint32_t)max_ranges);
+                ranges = max_ranges;
+            }
+
+            memory->tag = CB_TAG_MEMORY;
+            memory->size = sizeof(struct cb_memory) + ranges * sizeof(struct cb_memory_range);
+            for (size_t i = 0; i < ranges; i++) {
+                EFI_E820_ENTRY64 *e = &priv->e820_map[i];
+                memory->map[i].start.lo = (uint32_t)e->BaseAddr;
+                memory->map[i].start.hi = (uint32_t)(e->BaseAddr >> 32);
+                memory->map[i].size.lo = (uint32_t)e->Length;
+                memory->map[i].size.hi = (uint32_t)(e->Length >> 32);
+                memory->map[i].type = e->Type;
+            }
+            p += memory->size;
+            table_entries++;
+        }
+
         /* Last header stuff */
         header->table_entries = table_entries;
         header->table_bytes = (uint32_t)((uintptr_t)p - (uintptr_t)tables);
@@ -1,11 +1,23 @@
 #include <efi.h>
 #include <csmwrap.h>
 
+#include <clock.h>
+#include <config.h>
+#include <console.h>
 #include <io.h>
+#include <iommu.h>
+#include <lz4.h>
+#include <mp.h>
+#include <mtrr.h>
+#include <pci.h>
+#include <pcie.h>
+#include <perf.h>
+#include <quiesce.h>
+#include <timestamp.h>
 #include <x86thunk.h>
 #include <video.h>
 
-// Generated by: xxd -i Csm16.bin >> Csm16.h
+// Generated by: lz4 -l Csm16.bin && xxd -i Csm16.bin.lz4 >> Csm16.h
 #include <bins/Csm16.h>
 
 
@@ -20,11 +32,8 @@ const char *banner = "CSMWrap Version " BUILD_VERSION "\n"
 EFI_SYSTEM_TABLE *gST;
 EFI_BOOT_SERVICES *gBS;
 EFI_RUNTIME_SERVICES *gRT;
-EFI_TIME gTimeAtBoot;
 
-struct csmwrap_priv priv = {
-    .csm_bin = Csm16_bin,
-};
+struct csmwrap_priv priv;
 
 static void *find_table(uint32_t signature, uint8_t *csm_bin_base, size_t size)
 {
@@ -45,6 +54,27 @@ static void *find_table(uint32_t signature, uint8_t *csm_bin_base, size_t size)
     return Table;
 }
 
+/*
+ * Dry-run an LZ4 image into scratch memory. Anything wrong with it has to
+ * show up while we can still return to the firmware, the real decompression
+ * into shadow RAM after ExitBootServices() then has nothing left to fail on.
+ * The caller frees the returned buffer.
+ */
+static void *check_lz4_image(const void *src, size_t src_size, size_t size)
+{
+    void *scratch;
+
+    if (gBS->AllocatePool(EfiLoaderData, size, &scratch) != EFI_SUCCESS) {
+        return NULL;
+    }
+    if (lz4_decompress(scratch, size, src, src_size) != size) {
+        gBS->FreePool(scratch);
+        return NULL;
+    }
+
+    return scratch;
+}
+
 int set_smbios_table()
 {
     EFI_GUID smbiosGuid = SMBIOS_TABLE_GUID;
@@ -55,7 +85,7 @@ int set_smbios_table()
         EFI_CONFIGURATION_TABLE *table = gST->ConfigurationTable + i;
 
         if (!efi_guidcmp(table->VendorGuid, smbiosGuid)) {
-            printf("Found SMBIOS Table at %x\n", (uintptr_t)table->VendorTable);
+            printf_verbose("Found SMBIOS Table at %lx\n", (unsigned long)(uintptr_t)table->VendorTable);
             if (table_addr < 0x100000000) {
                 table_addr = (uintptr_t)table->VendorTable;
             }
@@ -68,7 +98,7 @@ int set_smbios_table()
             EFI_CONFIGURATION_TABLE *table = gST->ConfigurationTable + i;
 
             if (!efi_guidcmp(table->VendorGuid, smbios3Guid)) {
-                printf("Found SMBIOS 3.0 Table at %x\n", (uintptr_t)table->VendorTable);
+                printf_verbose("Found SMBIOS 3.0 Table at %lx\n", (unsigned long)(uintptr_t)table->VendorTable);
                 if (table_addr < 0x100000000) {
                     table_addr = (uintptr_t)table->VendorTable;
                 }
@@ -91,6 +121,8 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 {
     EFI_PHYSICAL_ADDRESS HiPmm;
     uintptr_t csm_bin_base;
+    uintptr_t csm_table_offset;
+    void *scratch;
     EFI_STATUS Status;
     EFI_IA32_REGISTER_SET Regs;
 
@@ -98,14 +130,28 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     gBS = SystemTable->BootServices;
     gRT = SystemTable->RuntimeServices;
 
+    libc_init();
+    config_init(ImageHandle);
+    console_init();
+    timestamp_init();
+
     gBS->SetWatchdogTimer(0, 0, 0, NULL);
 
     printf("%s", banner);
 
-    if (gRT->GetTime(&gTimeAtBoot, NULL) != EFI_SUCCESS) {
-        printf("Failed to query current time\n");
-        return -1;
-    }
+    timestamp_add_now(TS_ACPI_INIT_START);
+    acpi_init();
+    timestamp_add_now(TS_ACPI_INIT_END);
+
+    /* Wants the FADT for the PM timer */
+    clock_init();
+    timestamp_set_tick_freq(clock_tsc_hz());
+
+    /* Wants the MCFG for ECAM */
+    pci_init();
+    mp_init();
+    /* DMAR/IVRS are gone after acpi_prepare_exitbs() */
+    iommu_init();
 
     EFI_GUID loaded_image_guid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
     EFI_LOADED_IMAGE_PROTOCOL *loaded_image = NULL;
@@ -146,31 +192,80 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 
     gBS->RaiseTPL(TPL_NOTIFY);
 
+    timestamp_add_now(TS_UNLOCK_START);
     if (unlock_bios_region()) {
         printf("Unable to unlock BIOS region\n");
         return -1;
     }
+    timestamp_add_now(TS_UNLOCK_END);
     printf("Unlock!\n");
+    /* Firmware often leaves 0xC0000-0xFFFFF uncached */
+    bios_region_cache_for_copy();
 
+    timestamp_add_now(TS_WORKAROUNDS_START);
     apply_intel_platform_workarounds();
+    timestamp_add_now(TS_WORKAROUNDS_END);
 
-    csm_bin_base = (uintptr_t)BIOSROM_END - sizeof(Csm16_bin);
+    csm_bin_base = (uintptr_t)BIOSROM_END - CSM16_BIN_SIZE;
     priv.csm_bin_base = csm_bin_base;
-    printf("csm_bin_base: 0x%lx\n", csm_bin_base);
+    printf_verbose("csm_bin_base: 0x%lx\n", (unsigned long)csm_bin_base);
     if (csm_bin_base < VGABIOS_END) {
         printf("Illegal csm_bin size \n");
         return -1;
     }
+    printf_verbose("Csm16.bin: %u bytes, %u bytes compressed\n",
+           (uint32_t)CSM16_BIN_SIZE, (uint32_t)sizeof(Csm16_bin_lz4));
 
-    priv.csm_efi_table = find_table(EFI_COMPATIBILITY16_TABLE_SIGNATURE, Csm16_bin, sizeof(Csm16_bin));
-    if (priv.csm_efi_table == NULL) {
+    scratch = check_lz4_image(Csm16_bin_lz4, sizeof(Csm16_bin_lz4), CSM16_BIN_SIZE);
+    if (scratch == NULL) {
+        printf("Failed to decompress Csm16.bin\n");
+        return -1;
+    }
+    /* The table is patched in place once the image sits in shadow RAM */
+    void *csm_table = find_table(EFI_COMPATIBILITY16_TABLE_SIGNATURE, scratch, CSM16_BIN_SIZE);
+    csm_table_offset = (uintptr_t)csm_table - (uintptr_t)scratch;
+    gBS->FreePool(scratch);
+    if (csm_table == NULL) {
         printf("EFI_COMPATIBILITY16_TABLE not found\n");
         return -1;
     }
 
-    acpi_init(&priv);
-
+    timestamp_add_now(TS_VIDEO_INIT_START);
     Status = csmwrap_video_init(&priv);
+    timestamp_add_now(TS_VIDEO_INIT_END);
+
+    if (vbios_lz4_size != 0) {
+        scratch = check_lz4_image(vbios_loc, vbios_lz4_size, vbios_size);
+        if (scratch == NULL) {
+            printf("Failed to decompress vgabios.bin\n");
+            return -1;
+        }
+        gBS->FreePool(scratch);
+    }
+
+    /* Firmware usually leaves the framebuffer UC, which makes legacy text output crawl */
+    if (priv.video_type == CSMWRAP_VIDEO_SEAVGABIOS && gConfig.fb_wc) {
+        mtrr_set_wc(priv.cb_fb.physical_address,
+                    (uint64_t)priv.cb_fb.bytes_per_line * priv.cb_fb.y_resolution);
+    }
+    /* Final MTRR layout for the ROM lock, the APs keep it from here on */
+    if (gConfig.rom_lock) {
+        bios_region_protect_images(VGABIOS_START + vbios_size, csm_bin_base);
+    }
+    if (gConfig.log_level >= LOG_VERBOSE) {
+        mtrr_dump();
+    }
+    /* The unlock, WC and WP changes above only hit the BSP */
+    mp_sync_mtrrs();
+    /*
+     * The APs sit idle until the OS wakes them, but the BSP still has to
+     * copy the ROMs and run the Legacy16 calls, keep those write-back.
+     * lock_bios_region() brings the BSP back in line after PrepareToBoot.
+     */
+    if (gConfig.rom_lock) {
+        bios_region_cache_for_copy();
+    }
+    perf_apply_policy();
 
     HiPmm = 0xffffffff;
     if (gBS->AllocatePages(AllocateMaxAddress, EfiRuntimeServicesData, HIPMM_SIZE / EFI_PAGE_SIZE, &HiPmm) != EFI_SUCCESS) {
@@ -182,11 +277,10 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     memset((void*)LOW_STUB_BASE, 0, CONVEN_END - LOW_STUB_BASE);
 
     set_smbios_table();
-    priv.low_stub->boot_table.AcpiTable = priv.csm_efi_table->AcpiRsdPtrPointer;
 
     uintptr_t pmm_base = LegacyBiosInitializeThunkAndTable(LOW_STUB_BASE, sizeof(struct low_stub));
 
-    printf("Init Thunk pmm: %lx\n", (uintptr_t)pmm_base);
+    printf_verbose("Init Thunk pmm: %lx\n", (unsigned long)pmm_base);
 
     priv.low_stub->init_table.BiosLessThan1MB = 0x00080000; // Whole EBDA
     priv.low_stub->init_table.ThunkStart = (uint32_t)(uintptr_t)priv.low_stub;
@@ -200,14 +294,12 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     priv.low_stub->vga_oprom_table.PciBus = priv.vga_pci_bus;
     priv.low_stub->vga_oprom_table.PciDeviceFunction = priv.vga_pci_devfn;
 
-    build_coreboot_table(&priv);
-
-    printf("CALL16 %x:%x\n", priv.csm_efi_table->Compatibility16CallSegment,
-            priv.csm_efi_table->Compatibility16CallOffset);
+    timestamp_add_now(TS_EXIT_BOOT_SERVICES_START);
 
     /* WARNING: No EFI Video afterwards */
     csmwrap_video_prepare_exitbs(&priv);
     acpi_prepare_exitbs();
+    mp_prepare_exitbs();
 
     /* WARNING: No EFI runtime service afterwards */
     UINTN efi_mmap_size = 0, efi_desc_size = 0, efi_mmap_key = 0;
@@ -240,14 +332,37 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
         printf("Failed to exit boot services!");
         return -1;
     }
+    console_exit_boot_services();
 
     /* Disable external interrupts */
     asm volatile ("cli");
+    timestamp_add_now(TS_EXIT_BOOT_SERVICES_END);
+
+    /* The low PMM area is still unused, borrow a page of it for the SIPI test */
+    if (gConfig.ap_park) {
+        mp_park_aps(ALIGN_UP(LOW_STUB_BASE + sizeof(struct low_stub), EFI_PAGE_SIZE));
+    }
 
+    timestamp_add_now(TS_E820_START);
     build_e820_map(&priv, efi_mmap, efi_mmap_size, efi_desc_size);
-    uintptr_t e820_low = (uintptr_t)&priv.low_stub->e820_map;
-    priv.csm_efi_table->E820Pointer = e820_low;
-    priv.csm_efi_table->E820Length = sizeof(EFI_E820_ENTRY64) * priv.low_stub->e820_entries;
+    timestamp_add_now(TS_E820_END);
+
+    /* Needs the final E820 map for CB_TAG_MEMORY */
+    build_coreboot_table(&priv);
+
+    /* Stop leftover DMA first, the link and IOMMU changes below assume idle devices */
+    if (gConfig.quiesce) {
+        quiesce_devices();
+    }
+
+    /* Nothing after us manages link power, and no UEFI driver can undo it now */
+    pcie_apply_aspm_policy();
+    pcie_tune_payload();
+
+    /* Legacy drivers program physical addresses straight into their DMA engines */
+    if (gConfig.iommu_off && iommu_disable() != 0) {
+        printf("IOMMU still active, legacy DMA may fail\n");
+    }
 
     /* Disable 8259 PIC */
     outb(0x21, 0xff);
@@ -257,46 +372,77 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     outb(0x40, 0x00);
     outb(0x40, 0x00);
 
-    /* Copy ROM to location, as late as possible */
-    memcpy((void*)csm_bin_base, Csm16_bin, sizeof(Csm16_bin));
-    memcpy((void*)VGABIOS_START, vbios_loc, vbios_size);
+    /* Decompress/copy ROM to location, as late as possible. Both images were checked above. */
+    timestamp_add_now(TS_ROM_COPY_START);
+    lz4_decompress((void *)csm_bin_base, CSM16_BIN_SIZE, Csm16_bin_lz4, sizeof(Csm16_bin_lz4));
+    if (vbios_lz4_size != 0) {
+        lz4_decompress((void *)VGABIOS_START, vbios_size, vbios_loc, vbios_lz4_size);
+    } else {
+        memcpy((void*)VGABIOS_START, vbios_loc, vbios_size);
+    }
+    timestamp_add_now(TS_ROM_COPY_END);
+
+    priv.csm_efi_table = (EFI_COMPATIBILITY16_TABLE *)(csm_bin_base + csm_table_offset);
+
+    acpi_install_rsdp(&priv);
+    priv.low_stub->boot_table.AcpiTable = priv.csm_efi_table->AcpiRsdPtrPointer;
+    if (pci_ecam_base() <= 0xffffffff) {
+        priv.csm_efi_table->PciExpressBase = (uint32_t)pci_ecam_base();
+    }
+    /* Lets the CSM16 bound its own bus walk to what the inventory found */
+    priv.csm_efi_table->LastPciBus = pci_last_bus();
+
+    priv.csm_efi_table->E820Pointer = (uint32_t)(uintptr_t)priv.e820_map;
+    priv.csm_efi_table->E820Length = sizeof(EFI_E820_ENTRY64) * priv.e820_entries;
 
     memset(&Regs, 0, sizeof(EFI_IA32_REGISTER_SET));
     Regs.X.AX = Legacy16InitializeYourself;
     Regs.X.ES = EFI_SEGMENT(&priv.low_stub->init_table);
     Regs.X.BX = EFI_OFFSET(&priv.low_stub->init_table);
 
+    timestamp_add_now(TS_LEGACY16_INIT_START);
     LegacyBiosFarCall86(priv.csm_efi_table->Compatibility16CallSegment,
                         priv.csm_efi_table->Compatibility16CallOffset,
                         &Regs,
                         NULL,
                         0);
+    timestamp_add_now(TS_LEGACY16_INIT_END);
 
     memset(&Regs, 0, sizeof(EFI_IA32_REGISTER_SET));
     Regs.X.AX = Legacy16DispatchOprom;
     Regs.X.ES = EFI_SEGMENT(&priv.low_stub->vga_oprom_table);
     Regs.X.BX = EFI_OFFSET(&priv.low_stub->vga_oprom_table);
+    timestamp_add_now(TS_LEGACY16_OPROM_START);
     LegacyBiosFarCall86(priv.csm_efi_table->Compatibility16CallSegment,
                         priv.csm_efi_table->Compatibility16CallOffset,
                         &Regs,
                         NULL,
                         0);
+    timestamp_add_now(TS_LEGACY16_OPROM_END);
 
     memset(&Regs, 0, sizeof(EFI_IA32_REGISTER_SET));
     Regs.X.AX = Legacy16PrepareToBoot;
     Regs.X.ES = EFI_SEGMENT(&priv.low_stub->boot_table);
     Regs.X.BX = EFI_OFFSET(&priv.low_stub->boot_table);
 
+    timestamp_add_now(TS_LEGACY16_PREPARE_START);
     LegacyBiosFarCall86(priv.csm_efi_table->Compatibility16CallSegment,
                         priv.csm_efi_table->Compatibility16CallOffset,
                         &Regs,
                         NULL,
                         0);
+    timestamp_add_now(TS_LEGACY16_PREPARE_END);
+
+    if (gConfig.rom_lock) {
+        lock_bios_region(VGABIOS_START + vbios_size, csm_bin_base);
+    }
 
     memset(&Regs, 0, sizeof(EFI_IA32_REGISTER_SET));
     Regs.X.AX = Legacy16Boot;
     // No arguments?
 
+    timestamp_add_now(TS_LEGACY16_BOOT);
+    timestamp_dump();
     LegacyBiosFarCall86(priv.csm_efi_table->Compatibility16CallSegment,
                         priv.csm_efi_table->Compatibility16CallOffset,
                         &Regs,
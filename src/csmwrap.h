@@ -13,7 +13,6 @@
 extern EFI_SYSTEM_TABLE *gST;
 extern EFI_BOOT_SERVICES *gBS;
 extern EFI_RUNTIME_SERVICES *gRT;
-extern EFI_TIME gTimeAtBoot;
 
 enum csmwrap_video_type {
     CSMWRAP_VIDEO_NONE,
@@ -23,12 +22,14 @@ enum csmwrap_video_type {
 };
 
 struct csmwrap_priv {
-    uint8_t *csm_bin;
-
     EFI_COMPATIBILITY16_TABLE *csm_efi_table;
     uintptr_t csm_bin_base;
     struct low_stub *low_stub;
 
+    /* E820 memory map, in the low stub or at the top of HiPmm */
+    EFI_E820_ENTRY64 *e820_map;
+    size_t e820_entries;
+
     /* VGA stuff */
     enum csmwrap_video_type video_type;
     EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
@@ -40,8 +41,12 @@ struct csmwrap_priv {
 };
 
 extern int unlock_bios_region();
+int bios_region_cache_for_copy(void);
+int bios_region_protect_images(uintptr_t vgabios_end, uintptr_t csm_base);
+int lock_bios_region(uintptr_t vgabios_end, uintptr_t csm_base);
 extern int build_coreboot_table(struct csmwrap_priv *priv);
-bool acpi_init(struct csmwrap_priv *priv);
+bool acpi_init(void);
+void acpi_install_rsdp(struct csmwrap_priv *priv);
 bool acpi_full_init(void);
 void acpi_prepare_exitbs(void);
 int build_e820_map(struct csmwrap_priv *priv, EFI_MEMORY_DESCRIPTOR *memory_map, UINTN memory_map_size, UINTN descriptor_size);
@@ -65,8 +70,7 @@ struct low_stub {
     EFI_TO_COMPATIBILITY16_BOOT_TABLE boot_table;
     EFI_DISPATCH_OPROM_TABLE vga_oprom_table;
 
-    /* E820 memory map */
-    int e820_entries;
+    /* E820 memory map, unless it outgrows it */
     EFI_E820_ENTRY64 e820_map[E820_MAX_ENTRIES];
 };
 #pragma pack()
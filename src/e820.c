@@ -3,9 +3,6 @@
 #include <printf.h>
 #include "csmwrap.h"
 
-/* This is not in E820.h */
-#define EfiAcpiAddressRangeHole     (-1UL)
-
 static const char *
 e820_type_name(uint32_t type)
 {
@@ -18,129 +15,21 @@ e820_type_name(uint32_t type)
     }
 }
 
-// Remove an entry from the e820_map.
-static void
-remove_e820(struct csmwrap_priv *priv, int i)
-{
-    EFI_E820_ENTRY64 *e820_map = priv->low_stub->e820_map;
-    int *e820_count = &priv->low_stub->e820_entries;
-
-    if (i < 0 || i >= *e820_count) {
-        DEBUG((DEBUG_ERROR, "e820_map remove index out of range\n"));
-        return;
-    }
-
-    (*e820_count)--;
-    memmove(&e820_map[i], &e820_map[i+1],
-            sizeof(EFI_E820_ENTRY64) * (*e820_count - i));
-}
-
-// Insert an entry in the e820_map at the given position.
-static void
-insert_e820(struct csmwrap_priv *priv,
-            int i, uint64_t start, uint64_t size, uint64_t type)
-{
-    EFI_E820_ENTRY64 *e820_map = priv->low_stub->e820_map;
-    int *e820_count = &priv->low_stub->e820_entries;
-
-    if (*e820_count >= E820_MAX_ENTRIES) {
-        DEBUG((DEBUG_ERROR, "e820_map overflow\n"));
-        return;
-    }
-
-    memmove(&e820_map[i + 1], &e820_map[i],
-            sizeof(EFI_E820_ENTRY64) * (*e820_count - i));
-
-    (*e820_count)++;
-    EFI_E820_ENTRY64 *e = &e820_map[i];
-    e->BaseAddr = start;
-    e->Length = size;
-    e->Type = type;
-}
-
 // Show the current e820_map.
 static void
 dump_map(struct csmwrap_priv *priv)
 {
-    EFI_E820_ENTRY64 *e820_map = priv->low_stub->e820_map;
-    int e820_count = priv->low_stub->e820_entries;
+    EFI_E820_ENTRY64 *e820_map = priv->e820_map;
+    size_t e820_count = priv->e820_entries;
 
-    printf("csmwrap e820 map has %d items:\n", e820_count);
-    int i;
-    for (i = 0; i < e820_count; i++) {
+    printf("csmwrap e820 map has %u items:\n", (uint32_t)e820_count);
+    for (size_t i = 0; i < e820_count; i++) {
         EFI_E820_ENTRY64 *e = &e820_map[i];
         uint64_t e_end = e->BaseAddr + e->Length;
 
-        printf("  %d: %016llx - %016llx = %d %s\n", i,
-               e->BaseAddr, e_end, e->Type, e820_type_name(e->Type));
-    }
-}
-
-void e820_add(struct csmwrap_priv *priv, uint64_t start,
-              uint64_t size, uint64_t type)
-{
-    EFI_E820_ENTRY64 *e820_map = priv->low_stub->e820_map;
-    int *e820_count = &priv->low_stub->e820_entries;
-
-    if (!size)
-        return;
-
-    // Find position of new item (splitting existing item if needed).
-    uint64_t end = start + size;
-    int i;
-    for (i = 0; i < *e820_count; i++) {
-        EFI_E820_ENTRY64 *e = &e820_map[i];
-        uint64_t e_end = e->BaseAddr + e->Length;
-        if (start > e_end)
-            continue;
-        // Found position - check if an existing item needs to be split.
-        if (start > e->BaseAddr) {
-            if (type == e->Type) {
-                // Same type - merge them.
-                size += start - e->BaseAddr;
-                start = e->BaseAddr;
-            } else {
-                // Split existing item.
-                e->Length = start - e->BaseAddr;
-                i++;
-                if (e_end > end)
-                    insert_e820(priv, i, end, e_end - end, e->Type);
-            }
-        }
-        break;
+        printf("  %u: %016llx - %016llx = %d %s\n",
+               (uint32_t)i, (unsigned long long)e->BaseAddr, (unsigned long long)e_end, e->Type, e820_type_name(e->Type));
     }
-    // Remove/adjust existing items that are overlapping.
-    while (i < *e820_count) {
-        EFI_E820_ENTRY64 *e = &e820_map[i];
-        if (end < e->BaseAddr)
-            // No overlap - done.
-            break;
-        uint64_t e_end = e->BaseAddr + e->Length;
-        if (end >= e_end) {
-            // Existing item completely overlapped - remove it.
-            remove_e820(priv, i);
-            continue;
-        }
-        // Not completely overlapped - adjust its start.
-        e->BaseAddr = end;
-        e->Length = e_end - end;
-        if (type == e->Type) {
-            // Same type - merge them.
-            size += e->Length;
-            remove_e820(priv, i);
-        }
-        break;
-    }
-    // Insert new item.
-    if (type != EfiAcpiAddressRangeHole)
-        insert_e820(priv, i, start, size, type);
-}
-
-// Remove any definitions in a memory range (make a memory hole).
-void
-e820_remove(struct csmwrap_priv *priv, uint64_t start, uint64_t size)
-{
-    e820_add(priv, start, size, EfiAcpiAddressRangeHole);
 }
 
 /*
@@ -172,47 +61,151 @@ static uint32_t convert_memory_type(EFI_MEMORY_TYPE type)
     }
 }
 
+static void sift_down(EFI_E820_ENTRY64 *map, size_t root, size_t count)
+{
+    for (;;) {
+        size_t child = root * 2 + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count && map[child + 1].BaseAddr > map[child].BaseAddr)
+            child++;
+        if (map[root].BaseAddr >= map[child].BaseAddr)
+            break;
+
+        EFI_E820_ENTRY64 tmp = map[root];
+        map[root] = map[child];
+        map[child] = tmp;
+        root = child;
+    }
+}
+
+/* Sort by base address. Firmware maps are usually sorted already. */
+static void sort_e820(EFI_E820_ENTRY64 *map, size_t count)
+{
+    size_t i;
+
+    for (i = 1; i < count; i++) {
+        if (map[i].BaseAddr < map[i - 1].BaseAddr)
+            break;
+    }
+    if (i >= count)
+        return;
+
+    /* Heapsort, it needs no scratch memory and we have no allocator now */
+    for (i = count / 2; i-- > 0;)
+        sift_down(map, i, count);
+    for (i = count; i-- > 1;) {
+        EFI_E820_ENTRY64 tmp = map[0];
+        map[0] = map[i];
+        map[i] = tmp;
+        sift_down(map, 0, i);
+    }
+}
+
+// Append a range, merging it into the last entry if adjacent and same type.
+static void append_e820(EFI_E820_ENTRY64 *map, size_t *count,
+                        uint64_t start, uint64_t end, uint32_t type)
+{
+    if (*count > 0) {
+        EFI_E820_ENTRY64 *last = &map[*count - 1];
+        if (last->Type == type && last->BaseAddr + last->Length == start) {
+            last->Length = end - last->BaseAddr;
+            return;
+        }
+    }
+
+    map[*count].BaseAddr = start;
+    map[*count].Length = end - start;
+    map[*count].Type = type;
+    (*count)++;
+}
+
 /*
  * Build E820 memory map based on UEFI GetMemoryMap
- * Return the number of entries in the E820 map
+ *
+ * Descriptors are converted in place in the memory map buffer, sorted and
+ * coalesced in a single pass, then prefixed with the fixed layout below 1MB.
+ * If the result does not fit into the low stub, it is placed at the top of
+ * HiPmm, which the CSM sees as reserved memory.
  */
 int build_e820_map(struct csmwrap_priv *priv, EFI_MEMORY_DESCRIPTOR *memory_map, UINTN memory_map_size, UINTN descriptor_size)
 {
-    EFI_MEMORY_DESCRIPTOR *memory_map_end;
-    EFI_MEMORY_DESCRIPTOR *memory_map_ptr;
-
-    memory_map_end = (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)memory_map + memory_map_size);
-
-    /* Process each memory descriptor and convert to E820 format */
-    for (memory_map_ptr = memory_map; 
-         memory_map_ptr < memory_map_end;
-         memory_map_ptr = NextMemoryDescriptor(memory_map_ptr, descriptor_size)) {
-
-        uint64_t start = memory_map_ptr->PhysicalStart;
-        uint64_t end = start + (memory_map_ptr->NumberOfPages * EFI_PAGE_SIZE);
-        uint32_t type = convert_memory_type(memory_map_ptr->Type);
-        
-        /* Skip zero-length regions */
-        if (start == end)
+    EFI_E820_ENTRY64 *map = (EFI_E820_ENTRY64 *)memory_map;
+    size_t count = 0;
+    size_t merged = 0;
+
+    /*
+     * Convert each descriptor to E820 format. An E820 entry is smaller
+     * than a descriptor, so entry i never overlaps descriptor i + 1.
+     */
+    for (UINTN offset = 0; offset + descriptor_size <= memory_map_size; offset += descriptor_size) {
+        EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)memory_map + offset);
+        uint64_t start = desc->PhysicalStart;
+        uint64_t end = start + (desc->NumberOfPages * EFI_PAGE_SIZE);
+        uint32_t type = convert_memory_type(desc->Type);
+
+        /* The first 1MB is laid out by us */
+        if (end <= 0x100000)
             continue;
+        if (start < 0x100000)
+            start = 0x100000;
 
-        /* Skip memory types that are not reported in E820 */
-        if (type == 0)
-            continue;
+        map[count].BaseAddr = start;
+        map[count].Length = end - start;
+        map[count].Type = type;
+        count++;
+    }
+
+    sort_e820(map, count);
+
+    /* Coalesce in place, overlapping ranges are clipped to what precedes them */
+    for (size_t i = 0; i < count; i++) {
+        uint64_t start = map[i].BaseAddr;
+        uint64_t end = start + map[i].Length;
+
+        if (merged > 0) {
+            EFI_E820_ENTRY64 *last = &map[merged - 1];
+            uint64_t last_end = last->BaseAddr + last->Length;
+
+            if (start < last_end) {
+                if (end <= last_end)
+                    continue;
+                if (last->Type != map[i].Type) {
+                    DEBUG((DEBUG_ERROR, "e820: overlapping ranges at %llx\n", (unsigned long long)start));
+                }
+                start = last_end;
+            }
+        }
+
+        append_e820(map, &merged, start, end, map[i].Type);
+    }
+
+    /* Two more entries for the first 1MB */
+    size_t needed = merged + 2;
+    EFI_E820_ENTRY64 *out = priv->low_stub->e820_map;
+
+    if (needed > E820_MAX_ENTRIES) {
+        uint32_t spill = ALIGN_UP((uint32_t)(needed * sizeof(EFI_E820_ENTRY64)), EFI_PAGE_SIZE);
+        EFI_TO_COMPATIBILITY16_INIT_TABLE *init_table = &priv->low_stub->init_table;
+
+        init_table->HiPmmMemorySizeInBytes -= spill;
+        out = (EFI_E820_ENTRY64 *)(uintptr_t)(init_table->HiPmmMemory + init_table->HiPmmMemorySizeInBytes);
+        printf("e820: %u entries, placed at %x\n", (uint32_t)needed, (uint32_t)(uintptr_t)out);
+    }
 
-        e820_add(priv, start, end - start, type);
+    count = 0;
+    /* All low memory is usable */
+    append_e820(out, &count, 0, EBDA_BASE, EfiAcpiAddressRangeMemory);
+    /* Reserve EBDA and Expansion BIOS */
+    append_e820(out, &count, EBDA_BASE, 0x100000, EfiAcpiAddressRangeReserved);
+    for (size_t i = 0; i < merged; i++) {
+        append_e820(out, &count, map[i].BaseAddr, map[i].BaseAddr + map[i].Length, map[i].Type);
     }
 
-    /* Remove whole 1MB, we are going to fix it later */
-    e820_remove(priv, 0, 0x100000);
-    /* Add all low memory as usable */
-    e820_add(priv, 0, 0x80000, EfiAcpiAddressRangeMemory);
-    /* Reserve EBDA */
-    e820_add(priv, EBDA_BASE, 0x20000, EfiAcpiAddressRangeReserved);
-    /* Reserve Expansion BIOS */
-    e820_add(priv, 0xa0000, 0x100000 - 0xa0000, EfiAcpiAddressRangeReserved);
+    priv->e820_map = out;
+    priv->e820_entries = count;
 
-    if (DEBUG_PRINT_LEVEL & DEBUG_VERBOSE) {
+    if ((DEBUG_PRINT_LEVEL & DEBUG_VERBOSE) && gConfig.log_level >= LOG_DEBUG) {
         dump_map(priv);
     }
 
@@ -244,6 +244,19 @@ struct cbmem_console {
   UINT8     body[0];
 } __attribute__ ((packed));
 
+struct timestamp_entry {
+  UINT32    entry_id;
+  INT64     entry_stamp;
+} __attribute__ ((packed));
+
+struct timestamp_table {
+  UINT64                    base_time;
+  UINT16                    max_entries;
+  UINT16                    tick_freq_mhz;
+  UINT32                    num_entries;
+  struct timestamp_entry    entries[0]; /* Relative to base_time */
+} __attribute__ ((packed));
+
 #define CB_TAG_MRC_CACHE  0x0018
 struct cb_cbmem_tab {
   UINT32    tag;
@@ -251,6 +264,13 @@ struct cb_cbmem_tab {
   UINT64    cbmem_tab;
 };
 
+#define CB_TAG_TSC_INFO  0x0032
+struct cb_tsc_info {
+  UINT32    tag;
+  UINT32    size;
+  UINT32    freq_khz;
+};
+
 #define CB_TAG_SMMSTOREV2  0x0039
 struct cb_smmstorev2 {
   UINT32    tag;
@@ -0,0 +1,78 @@
+/** @file
+  DMA Remapping Reporting (DMAR) ACPI table definition from Intel(R)
+  Virtualization Technology for Directed I/O (VT-D) Architecture Specification.
+
+  Copyright (c) 2016 - 2021, Intel Corporation. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+  @par Revision Reference:
+    - Intel(R) Virtualization Technology for Directed I/O (VT-D) Architecture
+      Specification v3.3, Dated April 2021.
+
+**/
+
+#ifndef _DMA_REMAPPING_REPORTING_TABLE_H_
+#define _DMA_REMAPPING_REPORTING_TABLE_H_
+
+#include "Acpi.h"
+
+#pragma pack(1)
+
+///
+/// DMA-Remapping Reporting Structure definitions from section 8.1
+///@{
+#define EFI_ACPI_DMAR_REVISION  0x01
+
+#define EFI_ACPI_DMAR_FLAGS_INTR_REMAP         0x01
+#define EFI_ACPI_DMAR_FLAGS_X2APIC_OPT_OUT     0x02
+#define EFI_ACPI_DMAR_FLAGS_DMA_CTRL_PLATFORM_OPT_IN_FLAG  0x04
+///@}
+
+///
+/// Remapping Structure Types definitions from section 8.2
+///@{
+#define EFI_ACPI_DMAR_TYPE_DRHD  0x00
+#define EFI_ACPI_DMAR_TYPE_RMRR  0x01
+#define EFI_ACPI_DMAR_TYPE_ATSR  0x02
+#define EFI_ACPI_DMAR_TYPE_RHSA  0x03
+#define EFI_ACPI_DMAR_TYPE_ANDD  0x04
+#define EFI_ACPI_DMAR_TYPE_SATC  0x05
+///@}
+
+///
+/// DMA-Remapping Hardware Unit definitions from section 8.3
+///
+#define EFI_ACPI_DMAR_DRHD_FLAGS_INCLUDE_PCI_ALL  0x01
+
+///
+/// DMAR Table header, see section 8.1
+///
+typedef struct {
+  EFI_ACPI_DESCRIPTION_HEADER    Header;
+  UINT8                          HostAddressWidth;
+  UINT8                          Flags;
+  UINT8                          Reserved[10];
+} EFI_ACPI_DMAR_HEADER;
+
+///
+/// Remapping Structure header, common to all remapping structures
+///
+typedef struct {
+  UINT16    Type;
+  UINT16    Length;
+} EFI_ACPI_DMAR_STRUCTURE_HEADER;
+
+///
+/// DMA-remapping hardware unit definition (DRHD) structure, see section 8.3
+///
+typedef struct {
+  EFI_ACPI_DMAR_STRUCTURE_HEADER    Header;
+  UINT8                             Flags;
+  UINT8                             Size;
+  UINT16                            SegmentNumber;
+  UINT64                            RegisterBaseAddress;
+} EFI_ACPI_DMAR_DRHD_HEADER;
+
+#pragma pack()
+
+#endif
@@ -2,6 +2,7 @@
 #define _EDK2_COMPAT_H_
 
 #include <efi.h>
+#include <printf.h>
 
 /* Packed is already handled by pragmas */
 #define PACKED
@@ -40,14 +41,22 @@
                                          // related to modules such as Redfish, IPMI, MCTP etc.
 #define DEBUG_ERROR  0x80000000          // Error messages
 
+//
+// Levels compiled in, which of them print is decided by the runtime log level
+//
 #ifndef DEBUG_PRINT_LEVEL
-#define DEBUG_PRINT_LEVEL  (DEBUG_ERROR)
+#define DEBUG_PRINT_LEVEL  (DEBUG_ERROR | DEBUG_WARN | DEBUG_INFO | DEBUG_VERBOSE)
 #endif
 
+#define _DEBUG_LOG_LEVEL(PrintLevel)                                  \
+    (((PrintLevel) & DEBUG_ERROR) ? LOG_INFO :                          \
+     ((PrintLevel) & (DEBUG_WARN | DEBUG_INFO)) ? LOG_VERBOSE : LOG_DEBUG)
+
 #define _DEBUG_PRINT(PrintLevel, ...)              \
     do {                                             \
-      if (PrintLevel & DEBUG_PRINT_LEVEL) {     \
-        printf (#__VA_ARGS__);      \
+      if (((PrintLevel) & DEBUG_PRINT_LEVEL) &&       \
+          gConfig.log_level >= _DEBUG_LOG_LEVEL(PrintLevel)) { \
+        printf (__VA_ARGS__);      \
       }                                              \
     } while (FALSE)
 #define _DEBUGLIB_DEBUG(Expression)  _DEBUG_PRINT Expression
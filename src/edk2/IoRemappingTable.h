@@ -0,0 +1,58 @@
+/** @file
+  ACPI IO Remapping Table (IVRS) definition from the AMD I/O Virtualization
+  Technology (IOMMU) Specification.
+
+  Copyright (C) 2023 Advanced Micro Devices, Inc. All rights reserved.<BR>
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+  @par Revision Reference:
+    - AMD I/O Virtualization Technology (IOMMU) Specification, Rev 3.07-PUB
+
+**/
+
+#ifndef _IO_REMAPPING_TABLE_H_
+#define _IO_REMAPPING_TABLE_H_
+
+#include "Acpi.h"
+
+#pragma pack(1)
+
+#define EFI_ACPI_IVRS_REVISION  0x02
+
+///
+/// IVHD and IVMD block types
+///@{
+#define EFI_ACPI_IVHD_TYPE_10H  0x10
+#define EFI_ACPI_IVHD_TYPE_11H  0x11
+#define EFI_ACPI_IVHD_TYPE_40H  0x40
+#define EFI_ACPI_IVMD_TYPE_20H  0x20
+#define EFI_ACPI_IVMD_TYPE_21H  0x21
+#define EFI_ACPI_IVMD_TYPE_22H  0x22
+///@}
+
+///
+/// IVRS header
+///
+typedef struct {
+  EFI_ACPI_DESCRIPTION_HEADER    Header;
+  UINT32                         IvInfo;
+  UINT64                         Reserved;
+} EFI_ACPI_IVRS_HEADER;
+
+///
+/// IVHD header, common to all IVHD types
+///
+typedef struct {
+  UINT8     Type;
+  UINT8     Flags;
+  UINT16    Length;
+  UINT16    DeviceId;
+  UINT16    CapabilityOffset;
+  UINT64    IommuBaseAddress;
+  UINT16    PciSegmentGroup;
+  UINT16    IommuInfo;
+} EFI_ACPI_IVHD_HEADER;
+
+#pragma pack()
+
+#endif
@@ -2,6 +2,9 @@
 #include "csmwrap.h"
 
 #include "io.h"
+#include "pci.h"
+#include "pit.h"
+#include "clock.h"
 
 #define PCI_DEVICE_NUMBER_PCH_P2SB                 31
 #define PCI_FUNCTION_NUMBER_PCH_P2SB               1
@@ -20,36 +23,6 @@
 
 #define PCH_PCR_ADDRESS(Base, Pid, Offset)    ((void *)(Base | (UINT32) (((Offset) & 0x0F0000) << 8) | ((UINT8)(Pid) << 16) | (UINT16) ((Offset) & 0xFFFF)))
 
-#define PORT_PIT_COUNTER0      0x0040
-#define PORT_PIT_COUNTER1      0x0041
-#define PORT_PIT_COUNTER2      0x0042
-#define PORT_PIT_MODE          0x0043
-#define PORT_PS2_CTRLB         0x0061
-
-// Bits for PORT_PIT_MODE
-#define PM_SEL_TIMER0   (0<<6)
-#define PM_SEL_TIMER1   (1<<6)
-#define PM_SEL_TIMER2   (2<<6)
-#define PM_SEL_READBACK (3<<6)
-#define PM_ACCESS_LATCH  (0<<4)
-#define PM_ACCESS_LOBYTE (1<<4)
-#define PM_ACCESS_HIBYTE (2<<4)
-#define PM_ACCESS_WORD   (3<<4)
-#define PM_MODE0 (0<<1)
-#define PM_MODE1 (1<<1)
-#define PM_MODE2 (2<<1)
-#define PM_MODE3 (3<<1)
-#define PM_MODE4 (4<<1)
-#define PM_MODE5 (5<<1)
-#define PM_CNT_BINARY (0<<0)
-#define PM_CNT_BCD    (1<<0)
-#define PM_READ_COUNTER0 (1<<1)
-#define PM_READ_COUNTER1 (1<<2)
-#define PM_READ_COUNTER2 (1<<3)
-#define PM_READ_STATUSVALUE (0<<4)
-#define PM_READ_VALUE       (1<<4)
-#define PM_READ_STATUS      (2<<4)
-
 #define R_P2SB_CFG_P2SBC                      0x000000e0U      ///< P2SB Control
                                                                /* P2SB general configuration register
                                                                 */
@@ -62,39 +35,39 @@ static int pit_8254cge_workaround(void)
     bool p2sb_hide = false;
     int pch_pci_bus = 0;
 
-    reg = pciConfigReadDWord(pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
-                             PCI_FUNCTION_NUMBER_PCH_P2SB,
-                             0x0);
+    reg = pci_read32(0, pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
+                     PCI_FUNCTION_NUMBER_PCH_P2SB,
+                     0x0);
 
     /* P2SB maybe hidden, try unhide it first */
     if ((reg & 0xFFFF) == 0xffff) {
-        reg = pciConfigReadDWord(pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
-                                 PCI_FUNCTION_NUMBER_PCH_P2SB,
-                                 R_P2SB_CFG_P2SBC);
+        reg = pci_read32(0, pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
+                         PCI_FUNCTION_NUMBER_PCH_P2SB,
+                         R_P2SB_CFG_P2SBC);
         reg &= ~B_P2SB_CFG_P2SBC_HIDE;
-        pciConfigWriteDWord(pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
-                            PCI_FUNCTION_NUMBER_PCH_P2SB,
-                            R_P2SB_CFG_P2SBC, reg);
+        pci_write32(0, pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
+                    PCI_FUNCTION_NUMBER_PCH_P2SB,
+                    R_P2SB_CFG_P2SBC, reg);
         p2sb_hide = true;
     }
 
-    reg = pciConfigReadDWord(pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
-                              PCI_FUNCTION_NUMBER_PCH_P2SB,
-                              0x0);
+    reg = pci_read32(0, pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
+                     PCI_FUNCTION_NUMBER_PCH_P2SB,
+                     0x0);
 
     if ((reg & 0xFFFF) != 0x8086) {
         printf("No P2SB found, proceed to PIT test\n");
         goto test_pit;
     }
 
-    reg = pciConfigReadDWord(pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
-                              PCI_FUNCTION_NUMBER_PCH_P2SB,
-                              SBREG_BAR);
+    reg = pci_read32(0, pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
+                     PCI_FUNCTION_NUMBER_PCH_P2SB,
+                     SBREG_BAR);
     base = reg & ~0x0F;
 
-    reg = pciConfigReadDWord(pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
-                              PCI_FUNCTION_NUMBER_PCH_P2SB,
-                              SBREG_BARH);
+    reg = pci_read32(0, pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
+                     PCI_FUNCTION_NUMBER_PCH_P2SB,
+                     SBREG_BARH);
 #ifdef __LP64__
     base |= ((uint64_t)reg & 0xFFFFFFFF) << 32;
 #else
@@ -106,20 +79,20 @@ static int pit_8254cge_workaround(void)
 
     /* FIXME: Validate base */
     reg = readl(PCH_PCR_ADDRESS(base, PID_ITSS, R_PCH_PCR_ITSS_ITSSPRC));
-    printf("ITSSPRC = %x, ITSSPRC.8254CGE= %x\n", reg, !!(reg & B_PCH_PCR_ITSS_ITSSPRC_8254CGE));
+    printf_verbose("ITSSPRC = %x, ITSSPRC.8254CGE= %x\n", reg, !!(reg & B_PCH_PCR_ITSS_ITSSPRC_8254CGE));
     /* Disable 8254CGE */
     reg &= ~B_PCH_PCR_ITSS_ITSSPRC_8254CGE;
     writel(PCH_PCR_ADDRESS(base, PID_ITSS, R_PCH_PCR_ITSS_ITSSPRC), reg);
 
     /* Hide P2SB again */
     if (p2sb_hide) {
-        reg = pciConfigReadDWord(pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
-                                 PCI_FUNCTION_NUMBER_PCH_P2SB,
-                                 R_P2SB_CFG_P2SBC);
+        reg = pci_read32(0, pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
+                         PCI_FUNCTION_NUMBER_PCH_P2SB,
+                         R_P2SB_CFG_P2SBC);
         reg |= B_P2SB_CFG_P2SBC_HIDE;
-        pciConfigWriteDWord(pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
-                            PCI_FUNCTION_NUMBER_PCH_P2SB,
-                            R_P2SB_CFG_P2SBC, reg);
+        pci_write32(0, pch_pci_bus, PCI_DEVICE_NUMBER_PCH_P2SB,
+                    PCI_FUNCTION_NUMBER_PCH_P2SB,
+                    R_P2SB_CFG_P2SBC, reg);
     }
 
 test_pit:
@@ -127,7 +100,7 @@ test_pit:
     outb(PORT_PIT_MODE, PM_SEL_READBACK | PM_READ_VALUE | PM_READ_COUNTER0);
     uint16_t v1 = inb(PORT_PIT_COUNTER0) | (inb(PORT_PIT_COUNTER0) << 8);
 
-    gBS->Stall(1000);
+    udelay(1000);
     outb(PORT_PIT_MODE, PM_SEL_READBACK | PM_READ_VALUE | PM_READ_COUNTER0);
     uint16_t v2 = inb(PORT_PIT_COUNTER0) | (inb(PORT_PIT_COUNTER0) << 8);
     if (v1 == v2) {
@@ -140,11 +113,9 @@ test_pit:
 
 int apply_intel_platform_workarounds(void)
 {
-    uint16_t vendor_id;
-
-    vendor_id = pciConfigReadWord(0, 0, 0, 0x0);
+    struct pci_device *host_bridge = pci_find_device(0, 0, 0, 0);
 
-    if (vendor_id != 0x8086) {
+    if (host_bridge == NULL || host_bridge->vendor_id != 0x8086) {
         return 0;
     }
 
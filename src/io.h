@@ -290,6 +290,64 @@ static inline void wrmsr(uint32_t index, uint64_t val) {
     asm volatile ("wrmsr" :: "a"((uint32_t)val), "d"((uint32_t)(val >> 32)), "c"(index) : "memory");
 }
 
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile ("cpuid"
+                  : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                  : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint32_t cpuid_max_leaf(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    return eax;
+}
+
+static inline unsigned long read_cr0(void) {
+    unsigned long val;
+    asm volatile ("mov %%cr0, %0" : "=r"(val) :: "memory");
+    return val;
+}
+
+static inline void write_cr0(unsigned long val) {
+    asm volatile ("mov %0, %%cr0" :: "r"(val) : "memory");
+}
+
+static inline unsigned long read_cr3(void) {
+    unsigned long val;
+    asm volatile ("mov %%cr3, %0" : "=r"(val) :: "memory");
+    return val;
+}
+
+static inline void write_cr3(unsigned long val) {
+    asm volatile ("mov %0, %%cr3" :: "r"(val) : "memory");
+}
+
+static inline unsigned long read_cr4(void) {
+    unsigned long val;
+    asm volatile ("mov %%cr4, %0" : "=r"(val) :: "memory");
+    return val;
+}
+
+static inline void write_cr4(unsigned long val) {
+    asm volatile ("mov %0, %%cr4" :: "r"(val) : "memory");
+}
+
+static inline void wbinvd(void) {
+    asm volatile ("wbinvd" ::: "memory");
+}
+
+/* Disable interrupts, returning the previous flags for irq_restore() */
+static inline unsigned long irq_save(void) {
+    unsigned long flags;
+    asm volatile ("pushf\n\tpop %0\n\tcli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(unsigned long flags) {
+    asm volatile ("push %0\n\tpopf" :: "r"(flags) : "memory", "cc");
+}
+
 static inline uint64_t rdtsc(void) {
     uint32_t edx, eax;
     asm volatile ("rdtsc" : "=a" (eax), "=d" (edx) :: "memory");
@@ -0,0 +1,265 @@
+/*
+ * IOMMU teardown before handoff.
+ *
+ * Firmware with DMA protection leaves VT-d or AMD-Vi translating at
+ * ExitBootServices, with page tables only covering what UEFI drivers
+ * mapped. SeaBIOS and legacy OS drivers know nothing about that, so
+ * their DMA would fault or be blocked. Find every remapping unit while
+ * the ACPI tables are still around, then switch them all off.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "clock.h"
+#include "io.h"
+#include "iommu.h"
+#include "edk2/DmaRemappingReportingTable.h"
+#include "edk2/IoRemappingTable.h"
+
+#include <uacpi/tables.h>
+
+#define IOMMU_MAX_UNITS         16
+#define IOMMU_TIMEOUT_US        10000
+
+/* VT-d remapping unit registers */
+#define VTD_CAP_REG             0x08
+#define VTD_CAP_PLMR            (1ULL << 5)
+#define VTD_CAP_PHMR            (1ULL << 6)
+#define VTD_GCMD_REG            0x18
+#define VTD_GSTS_REG            0x1C
+#define VTD_GSTS_TES            (1u << 31)
+#define VTD_GSTS_IRES           (1u << 25)
+#define VTD_GSTS_QIES           (1u << 26)
+/* Status bits that reflect a setting, the rest of GCMD is one-shot commands */
+#define VTD_GSTS_PERSISTENT     0x96FFFFFFu
+#define VTD_PMEN_REG            0x64
+#define VTD_PMEN_EPM            (1u << 31)
+#define VTD_PMEN_PRS            (1u << 0)
+
+/* AMD-Vi MMIO registers */
+#define AMDVI_CONTROL_REG       0x18
+#define AMDVI_CTRL_IOMMU_EN     (1u << 0)
+#define AMDVI_CTRL_EVT_LOG_EN   (1u << 2)
+#define AMDVI_CTRL_EVT_INT_EN   (1u << 3)
+#define AMDVI_CTRL_CMD_BUF_EN   (1u << 12)
+#define AMDVI_STATUS_REG        0x2020
+#define AMDVI_STATUS_EVT_RUN    (1u << 3)
+#define AMDVI_STATUS_CMD_RUN    (1u << 4)
+
+enum iommu_type {
+    IOMMU_VTD,
+    IOMMU_AMDVI,
+};
+
+struct iommu_unit {
+    enum iommu_type type;
+    uintptr_t base;
+    uint16_t seg;
+};
+
+static struct iommu_unit iommu_units[IOMMU_MAX_UNITS];
+static size_t iommu_unit_count;
+
+static void iommu_add_unit(enum iommu_type type, uint64_t base, uint16_t seg)
+{
+    for (size_t i = 0; i < iommu_unit_count; i++) {
+        if (iommu_units[i].base == base) {
+            return;
+        }
+    }
+
+    if (base == 0 || base > UINTPTR_MAX || iommu_unit_count == IOMMU_MAX_UNITS) {
+        printf("IOMMU: skipping unit at %llx\n", (unsigned long long)base);
+        return;
+    }
+
+    struct iommu_unit *u = &iommu_units[iommu_unit_count++];
+    u->type = type;
+    u->base = base;
+    u->seg = seg;
+
+    printf_verbose("IOMMU: %s unit at %llx, segment %u\n",
+                   type == IOMMU_VTD ? "VT-d" : "AMD-Vi", (unsigned long long)base, seg);
+}
+
+static void iommu_parse_dmar(void)
+{
+    EFI_ACPI_DMAR_HEADER *dmar;
+    uacpi_table table;
+
+    if (uacpi_table_find_by_signature("DMAR", &table) != UACPI_STATUS_OK) {
+        return;
+    }
+
+    dmar = table.ptr;
+    uint8_t *p = (uint8_t *)(dmar + 1);
+    uint8_t *end = (uint8_t *)dmar + dmar->Header.Length;
+
+    while (p + sizeof(EFI_ACPI_DMAR_STRUCTURE_HEADER) <= end) {
+        EFI_ACPI_DMAR_STRUCTURE_HEADER *hdr = (void *)p;
+
+        if (hdr->Length < sizeof(*hdr) || p + hdr->Length > end) {
+            break;
+        }
+        if (hdr->Type == EFI_ACPI_DMAR_TYPE_DRHD &&
+            hdr->Length >= sizeof(EFI_ACPI_DMAR_DRHD_HEADER)) {
+            EFI_ACPI_DMAR_DRHD_HEADER *drhd = (void *)p;
+            iommu_add_unit(IOMMU_VTD, drhd->RegisterBaseAddress, drhd->SegmentNumber);
+        }
+        p += hdr->Length;
+    }
+
+    uacpi_table_unref(&table);
+}
+
+static void iommu_parse_ivrs(void)
+{
+    EFI_ACPI_IVRS_HEADER *ivrs;
+    uacpi_table table;
+
+    if (uacpi_table_find_by_signature("IVRS", &table) != UACPI_STATUS_OK) {
+        return;
+    }
+
+    ivrs = table.ptr;
+    uint8_t *p = (uint8_t *)(ivrs + 1);
+    uint8_t *end = (uint8_t *)ivrs + ivrs->Header.Length;
+
+    /* Type 10h/11h/40h blocks describe the same IOMMU more than once */
+    while (p + 4 <= end) {
+        EFI_ACPI_IVHD_HEADER *ivhd = (void *)p;
+
+        if (ivhd->Length < 4 || p + ivhd->Length > end) {
+            break;
+        }
+        if ((ivhd->Type == EFI_ACPI_IVHD_TYPE_10H ||
+             ivhd->Type == EFI_ACPI_IVHD_TYPE_11H ||
+             ivhd->Type == EFI_ACPI_IVHD_TYPE_40H) &&
+            ivhd->Length >= sizeof(*ivhd)) {
+            iommu_add_unit(IOMMU_AMDVI, ivhd->IommuBaseAddress, ivhd->PciSegmentGroup);
+        }
+        p += ivhd->Length;
+    }
+
+    uacpi_table_unref(&table);
+}
+
+void iommu_init(void)
+{
+    iommu_unit_count = 0;
+    iommu_parse_dmar();
+    iommu_parse_ivrs();
+}
+
+static bool iommu_wait_clear(uint8_t *reg, uint32_t mask)
+{
+    uint64_t deadline = clock_ns() + IOMMU_TIMEOUT_US * 1000ULL;
+
+    while (readl(reg) & mask) {
+        if (clock_ns() >= deadline) {
+            return false;
+        }
+        asm volatile ("pause");
+    }
+    return true;
+}
+
+/*
+ * GCMD takes one enable bit change per write, and every write has to
+ * carry the current state of the others.
+ */
+static bool vtd_clear_gcmd(uint8_t *regs, uint32_t bit)
+{
+    uint32_t gsts = readl(regs + VTD_GSTS_REG);
+
+    if (!(gsts & bit)) {
+        return true;
+    }
+    writel(regs + VTD_GCMD_REG, (gsts & VTD_GSTS_PERSISTENT) & ~bit);
+    return iommu_wait_clear(regs + VTD_GSTS_REG, bit);
+}
+
+static int vtd_disable(struct iommu_unit *u)
+{
+    uint8_t *regs = (uint8_t *)u->base;
+    uint32_t gsts = readl(regs + VTD_GSTS_REG);
+    uint64_t cap = readq(regs + VTD_CAP_REG);
+
+    if (gsts == 0xffffffff) {
+        printf("IOMMU: VT-d unit at %lx not responding\n", (unsigned long)u->base);
+        return -1;
+    }
+
+    printf_verbose("IOMMU: VT-d %lx GSTS %08x\n", (unsigned long)u->base, gsts);
+
+    /* Translation first, queued invalidation last since remapping uses it */
+    vtd_clear_gcmd(regs, VTD_GSTS_TES);
+    vtd_clear_gcmd(regs, VTD_GSTS_IRES);
+    vtd_clear_gcmd(regs, VTD_GSTS_QIES);
+
+    /* Protected memory regions block DMA even with translation off */
+    if ((cap & (VTD_CAP_PLMR | VTD_CAP_PHMR)) &&
+        (readl(regs + VTD_PMEN_REG) & VTD_PMEN_EPM)) {
+        writel(regs + VTD_PMEN_REG, 0);
+        iommu_wait_clear(regs + VTD_PMEN_REG, VTD_PMEN_PRS);
+    }
+
+    gsts = readl(regs + VTD_GSTS_REG);
+    if (gsts & (VTD_GSTS_TES | VTD_GSTS_IRES)) {
+        printf("IOMMU: VT-d unit at %lx still remapping, GSTS %08x\n", (unsigned long)u->base, gsts);
+        return -1;
+    }
+    if ((cap & (VTD_CAP_PLMR | VTD_CAP_PHMR)) &&
+        (readl(regs + VTD_PMEN_REG) & (VTD_PMEN_EPM | VTD_PMEN_PRS))) {
+        printf("IOMMU: VT-d unit at %lx still protecting memory\n", (unsigned long)u->base);
+        return -1;
+    }
+    return 0;
+}
+
+static int amdvi_disable(struct iommu_unit *u)
+{
+    uint8_t *regs = (uint8_t *)u->base;
+    uint32_t ctrl = readl(regs + AMDVI_CONTROL_REG);
+
+    if (ctrl == 0xffffffff) {
+        printf("IOMMU: AMD-Vi unit at %lx not responding\n", (unsigned long)u->base);
+        return -1;
+    }
+
+    printf_verbose("IOMMU: AMD-Vi %lx control %08x\n", (unsigned long)u->base, ctrl);
+
+    /* All the enables live in the low dword of the 64-bit control register */
+    ctrl &= ~(AMDVI_CTRL_IOMMU_EN | AMDVI_CTRL_EVT_LOG_EN |
+              AMDVI_CTRL_EVT_INT_EN | AMDVI_CTRL_CMD_BUF_EN);
+    writel(regs + AMDVI_CONTROL_REG, ctrl);
+    iommu_wait_clear(regs + AMDVI_STATUS_REG, AMDVI_STATUS_EVT_RUN | AMDVI_STATUS_CMD_RUN);
+
+    ctrl = readl(regs + AMDVI_CONTROL_REG);
+    uint32_t status = readl(regs + AMDVI_STATUS_REG);
+    if ((ctrl & AMDVI_CTRL_IOMMU_EN) ||
+        (status & (AMDVI_STATUS_EVT_RUN | AMDVI_STATUS_CMD_RUN))) {
+        printf("IOMMU: AMD-Vi unit at %lx still enabled, control %08x status %08x\n",
+               (unsigned long)u->base, ctrl, status);
+        return -1;
+    }
+    return 0;
+}
+
+int iommu_disable(void)
+{
+    int ret = 0;
+
+    for (size_t i = 0; i < iommu_unit_count; i++) {
+        struct iommu_unit *u = &iommu_units[i];
+
+        if ((u->type == IOMMU_VTD ? vtd_disable(u) : amdvi_disable(u)) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (iommu_unit_count != 0 && ret == 0) {
+        printf("IOMMU: remapping disabled on %u units\n", (uint32_t)iommu_unit_count);
+    }
+    return ret;
+}
@@ -0,0 +1,13 @@
+#ifndef IOMMU_H
+#define IOMMU_H
+
+/* Collect the remapping units from DMAR/IVRS, needs the early ACPI tables */
+void iommu_init(void);
+/*
+ * After ExitBootServices: turn off DMA and interrupt remapping and the
+ * protected memory regions on every unit, so legacy DMA goes straight
+ * to memory. Returns -1 if a unit did not report them off.
+ */
+int iommu_disable(void);
+
+#endif
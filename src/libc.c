@@ -1,18 +1,57 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <libc.h>
+#include <io.h>
+
+#ifdef __LP64__
+#define REP_MOVS_WORD "rep movsq"
+#define REP_STOS_WORD "rep stosq"
+#else
+#define REP_MOVS_WORD "rep movsl"
+#define REP_STOS_WORD "rep stosl"
+#endif
+
+/* Below this, aligning the head costs more than the word loop saves */
+#define WORD_COPY_THRESHOLD 64
+
+/* CPU has Enhanced REP MOVSB/STOSB or Fast Short REP MOV */
+static bool fast_strings;
+
+void libc_init(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (cpuid_max_leaf() < 7) {
+        return;
+    }
+
+    cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+    /* EBX[9] = ERMS, EDX[4] = FSRM */
+    fast_strings = (ebx & (1 << 9)) || (edx & (1 << 4));
+}
 
 #ifdef memcpy
 #  undef memcpy
 #endif
 void *memcpy(void *restrict dest, const void *restrict src, size_t n) {
-    uint8_t *restrict pdest = (uint8_t *restrict)dest;
-    const uint8_t *restrict psrc = (const uint8_t *restrict)src;
+    void *d = dest;
+    const void *s = src;
 
-    for (size_t i = 0; i < n; i++) {
-        pdest[i] = psrc[i];
+    if (!fast_strings && n >= WORD_COPY_THRESHOLD) {
+        size_t head = -(uintptr_t)d & (sizeof(size_t) - 1);
+        size_t words;
+
+        n -= head;
+        words = n / sizeof(size_t);
+        n %= sizeof(size_t);
+
+        asm volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(head) :: "memory");
+        asm volatile (REP_MOVS_WORD : "+D"(d), "+S"(s), "+c"(words) :: "memory");
     }
 
+    asm volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(n) :: "memory");
+
     return dest;
 }
 
@@ -20,12 +59,24 @@ void *memcpy(void *restrict dest, const void *restrict src, size_t n) {
 #  undef memset
 #endif
 void *memset(void *s, int c, size_t n) {
-    uint8_t *p = (uint8_t *)s;
+    void *d = s;
 
-    for (size_t i = 0; i < n; i++) {
-        p[i] = (uint8_t)c;
+    if (!fast_strings && n >= WORD_COPY_THRESHOLD) {
+        size_t head = -(uintptr_t)d & (sizeof(size_t) - 1);
+        /* Replicate the byte into every lane of a word */
+        size_t pattern = (uint8_t)c * (SIZE_MAX / 0xff);
+        size_t words;
+
+        n -= head;
+        words = n / sizeof(size_t);
+        n %= sizeof(size_t);
+
+        asm volatile ("rep stosb" : "+D"(d), "+c"(head) : "a"(c) : "memory");
+        asm volatile (REP_STOS_WORD : "+D"(d), "+c"(words) : "a"(pattern) : "memory");
     }
 
+    asm volatile ("rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+
     return s;
 }
 
@@ -33,19 +84,19 @@ void *memset(void *s, int c, size_t n) {
 #  undef memmove
 #endif
 void *memmove(void *dest, const void *src, size_t n) {
-    uint8_t *pdest = (uint8_t *)dest;
-    const uint8_t *psrc = (const uint8_t *)src;
-
-    if (src > dest) {
-        for (size_t i = 0; i < n; i++) {
-            pdest[i] = psrc[i];
-        }
-    } else if (src < dest) {
-        for (size_t i = n; i > 0; i--) {
-            pdest[i-1] = psrc[i-1];
-        }
+    /* Forward copy is safe unless dest lands inside [src, src + n) */
+    if ((uintptr_t)dest - (uintptr_t)src >= n) {
+        return memcpy(dest, src, n);
     }
 
+    void *d = (uint8_t *)dest + n - 1;
+    const void *s = (const uint8_t *)src + n - 1;
+
+    asm volatile ("std\n\t"
+                  "rep movsb\n\t"
+                  "cld"
+                  : "+D"(d), "+S"(s), "+c"(n) :: "memory", "cc");
+
     return dest;
 }
 
@@ -53,9 +104,18 @@ void *memmove(void *dest, const void *src, size_t n) {
 #  undef memcmp
 #endif
 int memcmp(const void *s1, const void *s2, size_t n) {
+    typedef size_t __attribute__((may_alias, aligned(1))) unaligned_word;
     const uint8_t *p1 = (const uint8_t *)s1;
     const uint8_t *p2 = (const uint8_t *)s2;
 
+    /* Skip the equal prefix a word at a time, then find the differing byte */
+    while (n >= sizeof(size_t) &&
+           *(const unaligned_word *)p1 == *(const unaligned_word *)p2) {
+        p1 += sizeof(size_t);
+        p2 += sizeof(size_t);
+        n -= sizeof(size_t);
+    }
+
     for (size_t i = 0; i < n; i++) {
         if (p1[i] != p2[i]) {
             return p1[i] < p2[i] ? -1 : 1;
@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 
+void libc_init(void);
+
 void *memcpy(void *restrict dest, const void *restrict src, size_t n);
 void *memset(void *s, int c, size_t n);
 void *memmove(void *dest, const void *src, size_t n);
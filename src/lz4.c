@@ -0,0 +1,131 @@
+/*
+ * Minimal LZ4 decoder for the legacy frame format ("lz4 -l"), which is what
+ * the build uses to embed Csm16.bin and vgabios.bin.
+ *
+ * The legacy format is a magic number followed by blocks, each prefixed with
+ * its 32-bit compressed size. Blocks never reference each other, so we can
+ * decode straight into the final destination without any scratch buffer.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libc.h>
+#include <lz4.h>
+
+#define LZ4_LEGACY_MAGIC    0x184C2102
+#define LZ4_MIN_MATCH       4
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Read the 255-continued extension of a literal or match length */
+static bool get_length(const uint8_t **in, const uint8_t *in_end, size_t *len)
+{
+    uint8_t b;
+
+    do {
+        if (*in >= in_end) {
+            return false;
+        }
+        b = *(*in)++;
+        *len += b;
+    } while (b == 255);
+
+    return true;
+}
+
+static uint8_t *decode_block(uint8_t *out, uint8_t *out_end,
+                             const uint8_t *in, const uint8_t *in_end)
+{
+    uint8_t *block_start = out;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+        size_t len = token >> 4;
+
+        /* Literals */
+        if (len == 15 && !get_length(&in, in_end, &len)) {
+            return NULL;
+        }
+        if (len > (size_t)(in_end - in) || len > (size_t)(out_end - out)) {
+            return NULL;
+        }
+        memcpy(out, in, len);
+        out += len;
+        in += len;
+
+        /* The last sequence of a block carries literals only */
+        if (in == in_end) {
+            break;
+        }
+
+        /* Match */
+        if (in_end - in < 2) {
+            return NULL;
+        }
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - block_start)) {
+            return NULL;
+        }
+
+        len = token & 15;
+        if (len == 15 && !get_length(&in, in_end, &len)) {
+            return NULL;
+        }
+        len += LZ4_MIN_MATCH;
+        if (len > (size_t)(out_end - out)) {
+            return NULL;
+        }
+
+        const uint8_t *match = out - offset;
+        if (offset >= len) {
+            memcpy(out, match, len);
+            out += len;
+        } else {
+            /* Overlapping match repeats the last offset bytes */
+            while (len--) {
+                *out++ = *match++;
+            }
+        }
+    }
+
+    return out;
+}
+
+size_t lz4_decompress(void *dst, size_t dst_size, const void *src, size_t src_size)
+{
+    const uint8_t *in = src;
+    const uint8_t *in_end = in + src_size;
+    uint8_t *out = dst;
+    uint8_t *out_end = out + dst_size;
+
+    if (src_size < 4 || get_le32(in) != LZ4_LEGACY_MAGIC) {
+        return 0;
+    }
+    in += 4;
+
+    while (in_end - in >= 4) {
+        uint32_t block_size = get_le32(in);
+        in += 4;
+
+        /* Concatenated frames just repeat the magic */
+        if (block_size == LZ4_LEGACY_MAGIC) {
+            continue;
+        }
+        if (block_size > (size_t)(in_end - in)) {
+            return 0;
+        }
+
+        out = decode_block(out, out_end, in, in + block_size);
+        if (out == NULL) {
+            return 0;
+        }
+        in += block_size;
+    }
+
+    return out - (uint8_t *)dst;
+}
@@ -0,0 +1,13 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Decompress an LZ4 legacy frame into dst.
+ * Returns the number of bytes written, or 0 on malformed input or overflow.
+ */
+size_t lz4_decompress(void *dst, size_t dst_size, const void *src, size_t src_size);
+
+#endif
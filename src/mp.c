@@ -0,0 +1,253 @@
+/*
+ * Multiprocessor support through EFI_MP_SERVICES_PROTOCOL.
+ *
+ * Only usable before ExitBootServices. The AP callbacks must not use
+ * boot services or printf, they just touch MSRs and shared memory.
+ * After ExitBootServices the APs are driven directly through the LAPIC.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "clock.h"
+#include "io.h"
+#include "edk2/MpService.h"
+#include "mp.h"
+#include "mtrr.h"
+
+/* Per StartupAllAPs() call, the AP work here is a few hundred MSR accesses */
+#define MP_TIMEOUT_US       1000000
+#define MP_MAX_APS          1024
+
+#define MSR_IA32_APIC_BASE  0x1B
+#define APIC_BASE_EXTD      (1 << 10)
+#define MSR_X2APIC_ICR      0x830
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define ICR_DELIVERY_INIT   (5 << 8)
+#define ICR_DELIVERY_SIPI   (6 << 8)
+#define ICR_SEND_PENDING    (1 << 12)
+#define ICR_LEVEL_ASSERT    (1 << 14)
+#define ICR_POLL_LIMIT      1000
+
+/* Timings from the MP spec INIT-SIPI-SIPI sequence */
+#define INIT_DELAY_US       10000
+#define SIPI_DELAY_US       200
+#define SIPI_TIMEOUT_US     100000
+
+/* Offset of the counter every AP bumps in the SIPI test trampoline */
+#define AP_TRAMPOLINE_COUNTER 0x20
+
+/* Real mode: cli; mov ax, cs; mov ds, ax; lock inc word [counter]; 1: hlt; jmp 1b */
+static const uint8_t ap_trampoline[] = {
+    0xfa,
+    0x8c, 0xc8,
+    0x8e, 0xd8,
+    0xf0, 0xff, 0x06, AP_TRAMPOLINE_COUNTER, 0x00,
+    0xf4,
+    0xeb, 0xfd,
+};
+
+static EFI_GUID gEfiMpServiceProtocolGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
+static EFI_MP_SERVICES_PROTOCOL *mp_services;
+static UINTN mp_enabled_cpus;
+
+/* APIC IDs of the enabled APs, for use after ExitBootServices */
+static uint32_t ap_apic_ids[MP_MAX_APS];
+static size_t ap_count;
+
+struct mtrr_sync {
+    struct mtrr_state bsp;
+    uint32_t done;
+    uint32_t mismatch;
+};
+
+static struct mtrr_sync mtrr_sync;
+
+static VOID EFIAPI mtrr_sync_ap(VOID *arg)
+{
+    struct mtrr_sync *sync = arg;
+    struct mtrr_state state;
+
+    mtrr_load(&sync->bsp);
+    mtrr_save(&state);
+    if (!mtrr_state_equal(&state, &sync->bsp)) {
+        __atomic_add_fetch(&sync->mismatch, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_add_fetch(&sync->done, 1, __ATOMIC_SEQ_CST);
+}
+
+void mp_init(void)
+{
+    UINTN cpus;
+
+    if (gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (void **)&mp_services) != EFI_SUCCESS) {
+        printf_verbose("MP: no MP services, APs are left alone\n");
+        mp_services = NULL;
+        return;
+    }
+
+    if (mp_services->GetNumberOfProcessors(mp_services, &cpus, &mp_enabled_cpus) != EFI_SUCCESS) {
+        printf("MP: unable to count processors\n");
+        mp_services = NULL;
+        return;
+    }
+
+    printf_verbose("MP: %u CPUs, %u enabled\n", (uint32_t)cpus, (uint32_t)mp_enabled_cpus);
+}
+
+int mp_sync_mtrrs(void)
+{
+    EFI_STATUS status;
+    uint32_t aps;
+
+    if (mp_services == NULL || mp_enabled_cpus <= 1 || !mtrr_supported()) {
+        return 0;
+    }
+
+    aps = mp_enabled_cpus - 1;
+    memset(&mtrr_sync, 0, sizeof(mtrr_sync));
+    mtrr_save(&mtrr_sync.bsp);
+
+    status = mp_services->StartupAllAPs(mp_services, mtrr_sync_ap, FALSE, NULL,
+                                        MP_TIMEOUT_US, &mtrr_sync, NULL);
+    if (status == EFI_NOT_STARTED) {
+        return 0;
+    }
+    if (EFI_ERROR(status) && status != EFI_TIMEOUT) {
+        printf("MP: MTRR sync failed: %lx\n", (unsigned long)status);
+        return -1;
+    }
+
+    uint32_t done = __atomic_load_n(&mtrr_sync.done, __ATOMIC_SEQ_CST);
+    uint32_t mismatch = __atomic_load_n(&mtrr_sync.mismatch, __ATOMIC_SEQ_CST);
+    if (done != aps || mismatch != 0) {
+        printf("MP: MTRRs differ from the BSP on %u of %u APs\n", mismatch + (aps - done), aps);
+        return -1;
+    }
+
+    printf_verbose("MP: MTRRs identical on all %u APs\n", aps);
+    return 0;
+}
+
+int mp_run_on_all_cpus(mp_func_t fn, void *arg)
+{
+    EFI_STATUS status;
+
+    fn(arg);
+
+    if (mp_services == NULL || mp_enabled_cpus <= 1) {
+        return 0;
+    }
+
+    status = mp_services->StartupAllAPs(mp_services, fn, FALSE, NULL, MP_TIMEOUT_US, arg, NULL);
+    if (EFI_ERROR(status) && status != EFI_NOT_STARTED) {
+        printf("MP: StartupAllAPs failed: %lx\n", (unsigned long)status);
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t mp_cpu_count(void)
+{
+    return mp_services ? mp_enabled_cpus : 1;
+}
+
+size_t mp_cpu_number(void)
+{
+    UINTN number;
+
+    if (mp_services == NULL || mp_services->WhoAmI(mp_services, &number) != EFI_SUCCESS) {
+        return 0;
+    }
+
+    return number;
+}
+
+void mp_prepare_exitbs(void)
+{
+    UINTN cpus, enabled;
+
+    ap_count = 0;
+    if (mp_services == NULL ||
+        mp_services->GetNumberOfProcessors(mp_services, &cpus, &enabled) != EFI_SUCCESS) {
+        return;
+    }
+
+    for (UINTN i = 0; i < cpus && ap_count < MP_MAX_APS; i++) {
+        EFI_PROCESSOR_INFORMATION info;
+
+        if (mp_services->GetProcessorInfo(mp_services, i, &info) != EFI_SUCCESS) {
+            continue;
+        }
+        if ((info.StatusFlag & PROCESSOR_AS_BSP_BIT) || !(info.StatusFlag & PROCESSOR_ENABLED_BIT)) {
+            continue;
+        }
+        ap_apic_ids[ap_count++] = (uint32_t)info.ProcessorId;
+    }
+}
+
+static void lapic_send_ipi(uint32_t apic_id, uint32_t icr)
+{
+    uint64_t apic_base = rdmsr(MSR_IA32_APIC_BASE);
+
+    if (apic_base & APIC_BASE_EXTD) {
+        wrmsr(MSR_X2APIC_ICR, (uint64_t)apic_id << 32 | icr);
+        return;
+    }
+
+    uint8_t *lapic = (uint8_t *)(uintptr_t)(apic_base & ~0xfffULL);
+    writel(lapic + LAPIC_ICR_HIGH, apic_id << 24);
+    writel(lapic + LAPIC_ICR_LOW, icr);
+    for (int i = 0; i < ICR_POLL_LIMIT && (readl(lapic + LAPIC_ICR_LOW) & ICR_SEND_PENDING); i++) {
+        udelay(1);
+    }
+}
+
+static void ap_send_init(void)
+{
+    for (size_t i = 0; i < ap_count; i++) {
+        lapic_send_ipi(ap_apic_ids[i], ICR_DELIVERY_INIT | ICR_LEVEL_ASSERT);
+    }
+    udelay(INIT_DELAY_US);
+}
+
+int mp_park_aps(uintptr_t trampoline)
+{
+    volatile uint16_t *counter = (volatile uint16_t *)(trampoline + AP_TRAMPOLINE_COUNTER);
+
+    if (ap_count == 0) {
+        return 0;
+    }
+
+    /* Pull the APs out of the firmware idle loop */
+    ap_send_init();
+
+    /* Start each one the way a legacy OS would, it checks in and halts */
+    memcpy((void *)trampoline, ap_trampoline, sizeof(ap_trampoline));
+    *counter = 0;
+    for (int sipi = 0; sipi < 2; sipi++) {
+        for (size_t i = 0; i < ap_count; i++) {
+            lapic_send_ipi(ap_apic_ids[i], ICR_DELIVERY_SIPI | (uint32_t)(trampoline >> 12));
+        }
+        udelay(SIPI_DELAY_US);
+    }
+
+    uint64_t deadline = clock_ns() + SIPI_TIMEOUT_US * 1000ULL;
+    while (*counter < ap_count && clock_ns() < deadline) {
+        asm volatile ("pause");
+    }
+    size_t started = *counter;
+
+    /* And back to wait-for-SIPI, which is all the OS expects to find */
+    ap_send_init();
+    memset((void *)trampoline, 0, EFI_PAGE_SIZE);
+
+    if (started != ap_count) {
+        printf("MP: only %u of %u APs answered INIT-SIPI-SIPI\n", (uint32_t)started, (uint32_t)ap_count);
+        return -1;
+    }
+
+    printf_verbose("MP: %u APs parked in wait-for-SIPI\n", (uint32_t)ap_count);
+    return 0;
+}
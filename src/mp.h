@@ -0,0 +1,29 @@
+#ifndef MP_H
+#define MP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <efi.h>
+
+/* Same ABI as EFI_AP_PROCEDURE, must not use boot services or printf */
+typedef VOID (EFIAPI *mp_func_t)(VOID *arg);
+
+void mp_init(void);
+/* Copy the BSP MTRR layout to every enabled AP and check they all match */
+int mp_sync_mtrrs(void);
+/* Run fn on the BSP, then on all enabled APs at once */
+int mp_run_on_all_cpus(mp_func_t fn, void *arg);
+/* Record the AP APIC IDs, last MP services call before ExitBootServices */
+void mp_prepare_exitbs(void);
+/*
+ * After ExitBootServices: INIT every AP, check it answers SIPI with a
+ * trampoline in the 4 KiB aligned scratch page below 1 MiB, then leave
+ * it waiting for SIPI.
+ */
+int mp_park_aps(uintptr_t trampoline);
+/* Enabled CPUs, including the BSP */
+size_t mp_cpu_count(void);
+/* Handle number of the calling CPU, also callable from APs */
+size_t mp_cpu_number(void);
+
+#endif
@@ -0,0 +1,367 @@
+/*
+ * MTRR based memory type management.
+ *
+ * Everything after Legacy16Boot runs with paging off, so PAT never
+ * applies to the legacy code and the MTRRs are the only way to change
+ * the memory type it sees.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "io.h"
+#include "mtrr.h"
+
+#define MSR_MTRR_CAP            0xFE
+#define MTRR_CAP_VCNT_MASK      0xff
+#define MTRR_CAP_FIX            (1 << 8)
+#define MTRR_CAP_WC             (1 << 10)
+#define MSR_MTRR_DEF_TYPE       0x2FF
+#define MTRR_DEF_TYPE_FE        (1 << 10)
+#define MTRR_DEF_TYPE_E         (1 << 11)
+#define MSR_MTRR_PHYS_BASE(n)   (0x200 + 2 * (n))
+#define MSR_MTRR_PHYS_MASK(n)   (0x201 + 2 * (n))
+#define MTRR_PHYS_MASK_VALID    (1 << 11)
+#define MTRR_TYPE_MASK          0xff
+#define MTRR_PAGE_SIZE          0x1000
+
+#define CPUID_1_EDX_MTRR        (1 << 12)
+/* "Auth"enticAMD and "Hygo"nGenuine */
+#define CPUID_EBX_AMD           0x68747541
+#define CPUID_EBX_HYGON         0x6f677948
+#define CR0_NW                  (1UL << 29)
+#define CR0_CD                  (1UL << 30)
+#define CR4_PGE                 (1UL << 7)
+
+/* Each fixed MTRR holds 8 one byte entries of step bytes each */
+static const struct {
+    uint32_t msr;
+    uint32_t base;
+    uint32_t step;
+} fixed_mtrrs[] = {
+    { 0x250, 0x00000, 0x10000 },
+    { 0x258, 0x80000, 0x4000 },
+    { 0x259, 0xA0000, 0x4000 },
+    { 0x268, 0xC0000, 0x1000 },
+    { 0x269, 0xC8000, 0x1000 },
+    { 0x26A, 0xD0000, 0x1000 },
+    { 0x26B, 0xD8000, 0x1000 },
+    { 0x26C, 0xE0000, 0x1000 },
+    { 0x26D, 0xE8000, 0x1000 },
+    { 0x26E, 0xF0000, 0x1000 },
+    { 0x26F, 0xF8000, 0x1000 },
+};
+
+static const char *mtrr_type_name(uint8_t type)
+{
+    switch (type) {
+        case MTRR_TYPE_UC: return "UC";
+        case MTRR_TYPE_WC: return "WC";
+        case MTRR_TYPE_WT: return "WT";
+        case MTRR_TYPE_WP: return "WP";
+        case MTRR_TYPE_WB: return "WB";
+        default:           return "??";
+    }
+}
+
+static uint64_t phys_addr_mask(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    unsigned int bits = 36;
+
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000008) {
+        cpuid(0x80000008, 0, &eax, &ebx, &ecx, &edx);
+        bits = eax & 0xff;
+    }
+
+    return ((1ULL << bits) - 1) & ~(uint64_t)(MTRR_PAGE_SIZE - 1);
+}
+
+static void flush_tlb(unsigned long cr4)
+{
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+}
+
+/* SDM 11.11.7.2, MTRRs may only change with caching off and MTRRs disabled */
+void mtrr_update_begin(struct mtrr_update *u)
+{
+    u->flags = irq_save();
+    u->cr0 = read_cr0();
+    write_cr0((u->cr0 | CR0_CD) & ~CR0_NW);
+    wbinvd();
+    u->cr4 = read_cr4();
+    flush_tlb(u->cr4);
+    u->def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, u->def_type & ~(uint64_t)MTRR_DEF_TYPE_E);
+}
+
+void mtrr_update_end(struct mtrr_update *u)
+{
+    wbinvd();
+    flush_tlb(u->cr4);
+    wrmsr(MSR_MTRR_DEF_TYPE, u->def_type);
+    write_cr0(u->cr0);
+    irq_restore(u->flags);
+}
+
+bool mtrr_supported(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return !!(edx & CPUID_1_EDX_MTRR);
+}
+
+static bool cpu_is_amd(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    return ebx == CPUID_EBX_AMD || ebx == CPUID_EBX_HYGON;
+}
+
+void mtrr_save(struct mtrr_state *state)
+{
+    memset(state, 0, sizeof(*state));
+
+    uint64_t cap = rdmsr(MSR_MTRR_CAP);
+    state->def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    state->vcnt = cap & MTRR_CAP_VCNT_MASK;
+    if (state->vcnt > MTRR_MAX_VARIABLE) {
+        state->vcnt = MTRR_MAX_VARIABLE;
+    }
+    for (unsigned int i = 0; i < state->vcnt; i++) {
+        state->var_base[i] = rdmsr(MSR_MTRR_PHYS_BASE(i));
+        state->var_mask[i] = rdmsr(MSR_MTRR_PHYS_MASK(i));
+    }
+
+    state->fixed_supported = !!(cap & MTRR_CAP_FIX);
+    state->amd = cpu_is_amd();
+
+    /* RdDram/WrDram only read back with MtrrFixDramModEn set */
+    uint64_t sys_cfg = 0;
+    if (state->amd) {
+        sys_cfg = rdmsr(MSR_SYS_CFG);
+        state->sys_cfg = sys_cfg & SYS_CFG_MTRR_MASK & ~(uint64_t)SYS_CFG_MTRR_FIX_DRAM_MOD_EN;
+        wrmsr(MSR_SYS_CFG, sys_cfg | SYS_CFG_MTRR_FIX_DRAM_MOD_EN);
+    }
+    if (state->fixed_supported) {
+        for (size_t i = 0; i < MTRR_FIXED_COUNT; i++) {
+            state->fixed[i] = rdmsr(fixed_mtrrs[i].msr);
+        }
+    }
+    if (state->amd) {
+        wrmsr(MSR_SYS_CFG, sys_cfg);
+    }
+}
+
+void mtrr_load(const struct mtrr_state *state)
+{
+    struct mtrr_update u;
+    uint64_t sys_cfg = 0;
+
+    mtrr_update_begin(&u);
+
+    if (state->amd) {
+        sys_cfg = rdmsr(MSR_SYS_CFG);
+        wrmsr(MSR_SYS_CFG, sys_cfg | SYS_CFG_MTRR_FIX_DRAM_MOD_EN);
+    }
+    if (state->fixed_supported) {
+        for (size_t i = 0; i < MTRR_FIXED_COUNT; i++) {
+            wrmsr(fixed_mtrrs[i].msr, state->fixed[i]);
+        }
+    }
+    for (unsigned int i = 0; i < state->vcnt; i++) {
+        wrmsr(MSR_MTRR_PHYS_BASE(i), state->var_base[i]);
+        wrmsr(MSR_MTRR_PHYS_MASK(i), state->var_mask[i]);
+    }
+    if (state->amd) {
+        wrmsr(MSR_SYS_CFG, (sys_cfg & ~(uint64_t)SYS_CFG_MTRR_MASK) | state->sys_cfg);
+    }
+
+    u.def_type = state->def_type;
+    mtrr_update_end(&u);
+}
+
+bool mtrr_state_equal(const struct mtrr_state *a, const struct mtrr_state *b)
+{
+    return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+int mtrr_set_fixed(uint32_t start, uint32_t end, uint8_t value)
+{
+    if (!mtrr_supported() || !(rdmsr(MSR_MTRR_CAP) & MTRR_CAP_FIX)) {
+        return -1;
+    }
+    if (!(rdmsr(MSR_MTRR_DEF_TYPE) & MTRR_DEF_TYPE_FE)) {
+        printf("MTRR: fixed range MTRRs disabled by firmware\n");
+        return -1;
+    }
+
+    bool amd = cpu_is_amd();
+    if (!amd) {
+        value &= ~(MTRR_FIXED_AMD_RDDRAM | MTRR_FIXED_AMD_WRDRAM);
+    }
+
+    struct mtrr_update u;
+    uint64_t sys_cfg = 0;
+
+    mtrr_update_begin(&u);
+    if (amd) {
+        sys_cfg = rdmsr(MSR_SYS_CFG);
+        wrmsr(MSR_SYS_CFG, sys_cfg | SYS_CFG_MTRR_FIX_DRAM_MOD_EN);
+    }
+
+    for (size_t i = 0; i < MTRR_FIXED_COUNT; i++) {
+        uint64_t val = rdmsr(fixed_mtrrs[i].msr);
+        uint64_t old = val;
+
+        for (unsigned int j = 0; j < 8; j++) {
+            uint32_t base = fixed_mtrrs[i].base + j * fixed_mtrrs[i].step;
+
+            if (base >= start && base + fixed_mtrrs[i].step <= end) {
+                val &= ~(0xffULL << (j * 8));
+                val |= (uint64_t)value << (j * 8);
+            }
+        }
+        if (val != old) {
+            wrmsr(fixed_mtrrs[i].msr, val);
+        }
+    }
+
+    if (amd) {
+        wrmsr(MSR_SYS_CFG, sys_cfg);
+    }
+    mtrr_update_end(&u);
+
+    return 0;
+}
+
+int mtrr_set_wc(uint64_t base, uint64_t size)
+{
+    if (!mtrr_supported()) {
+        printf("MTRR: not supported\n");
+        return -1;
+    }
+
+    uint64_t cap = rdmsr(MSR_MTRR_CAP);
+    if (!(cap & MTRR_CAP_WC)) {
+        printf("MTRR: write-combining not supported\n");
+        return -1;
+    }
+    if (!(rdmsr(MSR_MTRR_DEF_TYPE) & MTRR_DEF_TYPE_E)) {
+        printf("MTRR: disabled by firmware\n");
+        return -1;
+    }
+
+    /*
+     * Cover the naturally aligned power of two block around the range,
+     * a framebuffer sits in a BAR that is at least that large and aligned.
+     */
+    uint64_t end = base + size;
+    uint64_t block = MTRR_PAGE_SIZE;
+    while (block < size) {
+        block <<= 1;
+    }
+    while ((base & ~(block - 1)) + block < end) {
+        block <<= 1;
+    }
+    base &= ~(block - 1);
+    /* For printing only */
+    unsigned long long first = base, last = base + block - 1;
+
+    uint64_t addr_mask = phys_addr_mask();
+    if (((base + block - 1) & ~addr_mask) >= MTRR_PAGE_SIZE) {
+        printf("MTRR: %llx-%llx beyond physical address width\n", first, last);
+        return -1;
+    }
+
+    int free_slot = -1;
+    unsigned int vcnt = cap & MTRR_CAP_VCNT_MASK;
+    for (unsigned int i = 0; i < vcnt; i++) {
+        uint64_t mask = rdmsr(MSR_MTRR_PHYS_MASK(i));
+
+        if (!(mask & MTRR_PHYS_MASK_VALID)) {
+            if (free_slot < 0) {
+                free_slot = i;
+            }
+            continue;
+        }
+
+        uint64_t mbase = rdmsr(MSR_MTRR_PHYS_BASE(i));
+        uint8_t type = mbase & MTRR_TYPE_MASK;
+        mask &= addr_mask;
+
+        /* Some address in our block matches this MTRR */
+        if (((base ^ mbase) & mask & ~(block - 1)) != 0) {
+            continue;
+        }
+
+        if (type == MTRR_TYPE_WC && (mask & (block - 1)) == 0) {
+            printf_verbose("MTRR: %llx-%llx already WC\n", first, last);
+            return 0;
+        }
+
+        /* UC would win over WC, anything else overlapping is undefined */
+        printf("MTRR: %llx-%llx overlaps MTRR %u (%s), leaving it alone\n",
+               first, last, i, mtrr_type_name(type));
+        return -1;
+    }
+
+    if (free_slot < 0) {
+        printf("MTRR: no free variable MTRR for %llx-%llx\n", first, last);
+        return -1;
+    }
+
+    struct mtrr_update u;
+    mtrr_update_begin(&u);
+    wrmsr(MSR_MTRR_PHYS_BASE(free_slot), base | MTRR_TYPE_WC);
+    wrmsr(MSR_MTRR_PHYS_MASK(free_slot), (~(block - 1) & addr_mask) | MTRR_PHYS_MASK_VALID);
+    mtrr_update_end(&u);
+
+    printf_verbose("MTRR %d: %llx-%llx WC\n", free_slot, first, last);
+    return 0;
+}
+
+void mtrr_dump(void)
+{
+    if (!mtrr_supported()) {
+        return;
+    }
+
+    uint64_t cap = rdmsr(MSR_MTRR_CAP);
+    uint64_t def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    uint64_t addr_mask = phys_addr_mask();
+
+    printf("MTRR: %u variable, default %s, %s, fixed %s\n",
+           (uint32_t)(cap & MTRR_CAP_VCNT_MASK),
+           mtrr_type_name(def_type & MTRR_TYPE_MASK),
+           (def_type & MTRR_DEF_TYPE_E) ? "enabled" : "disabled",
+           (def_type & MTRR_DEF_TYPE_FE) ? "enabled" : "disabled");
+
+    if ((cap & MTRR_CAP_FIX) && (def_type & MTRR_DEF_TYPE_FE)) {
+        for (size_t i = 0; i < sizeof(fixed_mtrrs) / sizeof(fixed_mtrrs[0]); i++) {
+            printf("  fixed %05x: %016llx\n", fixed_mtrrs[i].base, (unsigned long long)rdmsr(fixed_mtrrs[i].msr));
+        }
+    }
+
+    for (unsigned int i = 0; i < (cap & MTRR_CAP_VCNT_MASK); i++) {
+        uint64_t mask = rdmsr(MSR_MTRR_PHYS_MASK(i));
+        uint64_t base = rdmsr(MSR_MTRR_PHYS_BASE(i));
+
+        if (!(mask & MTRR_PHYS_MASK_VALID)) {
+            continue;
+        }
+
+        mask &= addr_mask;
+        printf("  var %u: %016llx mask %016llx (%llu MiB) %s\n", i,
+               (unsigned long long)(base & addr_mask), (unsigned long long)mask,
+               (unsigned long long)(((~mask & addr_mask) + MTRR_PAGE_SIZE) >> 20),
+               mtrr_type_name(base & MTRR_TYPE_MASK));
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef MTRR_H
+#define MTRR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MTRR_TYPE_UC    0
+#define MTRR_TYPE_WC    1
+#define MTRR_TYPE_WT    4
+#define MTRR_TYPE_WP    5
+#define MTRR_TYPE_WB    6
+
+/* AMD fixed MTRR entries, route reads/writes to DRAM instead of MMIO */
+#define MTRR_FIXED_AMD_RDDRAM   (1 << 4)
+#define MTRR_FIXED_AMD_WRDRAM   (1 << 3)
+
+/* AMD SYS_CFG, controls how the fixed MTRR RdDram/WrDram bits apply */
+#define MSR_SYS_CFG                         0xC0010010ul
+#define SYS_CFG_MTRR_FIX_DRAM_EN            (1 << 18) ///< Core::X86::Msr::SYS_CFG::MtrrFixDramEn.
+                                                       ///< MTRR fixed RdDram and WrDram attributes enable.
+#define SYS_CFG_MTRR_FIX_DRAM_MOD_EN        (1 << 19) ///< Core::X86::Msr::SYS_CFG::MtrrFixDramModEn.
+                                                       ///< MTRR fixed RdDram and WrDram modification enable.
+#define SYS_CFG_MTRR_VAR_DRAM_EN            (1 << 20) ///< Core::X86::Msr::SYS_CFG::MtrrVarDramEn.
+                                                       ///< MTRR variable DRAM enable.
+#define SYS_CFG_MTRR_TOM2_EN                (1 << 21) ///< Core::X86::Msr::SYS_CFG::MtrrTom2En. MTRR
+                                                       ///< top of memory 2 enable.
+#define SYS_CFG_TOM2_FORCE_MEM_TYPE_WB      (1 << 22) ///< Core::X86::Msr::SYS_CFG::Tom2ForceMemTypeWB.
+                                                       ///< top of memory 2 memory type write back.
+#define SYS_CFG_MTRR_MASK                   (SYS_CFG_MTRR_FIX_DRAM_EN | SYS_CFG_MTRR_FIX_DRAM_MOD_EN | \
+                                             SYS_CFG_MTRR_VAR_DRAM_EN | SYS_CFG_MTRR_TOM2_EN | \
+                                             SYS_CFG_TOM2_FORCE_MEM_TYPE_WB)
+
+#define MTRR_FIXED_COUNT        11
+#define MTRR_MAX_VARIABLE       32
+
+/* Everything that has to match across CPUs for a consistent memory type layout */
+struct mtrr_state {
+    uint64_t def_type;
+    uint64_t fixed[MTRR_FIXED_COUNT];
+    uint64_t var_base[MTRR_MAX_VARIABLE];
+    uint64_t var_mask[MTRR_MAX_VARIABLE];
+    /* SYS_CFG_MTRR_MASK bits, AMD only */
+    uint64_t sys_cfg;
+    unsigned int vcnt;
+    bool fixed_supported;
+    bool amd;
+};
+
+/* Saved context for an MTRR update, see mtrr_update_begin() */
+struct mtrr_update {
+    unsigned long flags;
+    unsigned long cr0;
+    unsigned long cr4;
+    uint64_t def_type;
+};
+
+bool mtrr_supported(void);
+void mtrr_update_begin(struct mtrr_update *u);
+void mtrr_update_end(struct mtrr_update *u);
+/* These only touch MSRs, so APs may call them too */
+void mtrr_save(struct mtrr_state *state);
+void mtrr_load(const struct mtrr_state *state);
+bool mtrr_state_equal(const struct mtrr_state *a, const struct mtrr_state *b);
+/*
+ * Set the fixed MTRR entries inside [start, end) to value on this CPU.
+ * The AMD RdDram/WrDram bits in value are dropped on other CPUs.
+ */
+int mtrr_set_fixed(uint32_t start, uint32_t end, uint8_t value);
+/* Make [base, base + size) write-combining with a free variable MTRR */
+int mtrr_set_wc(uint64_t base, uint64_t size);
+void mtrr_dump(void);
+
+#endif
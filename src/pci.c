@@ -0,0 +1,513 @@
+/*
+ * PCI configuration space access.
+ *
+ * Uses the memory mapped ECAM windows described by the ACPI MCFG table,
+ * which reach every segment and the full 4KiB of extended config space
+ * with a single MMIO access. Falls back to the legacy 0xCF8/0xCFC ports
+ * for anything MCFG does not cover, those only reach segment 0 and the
+ * first 256 bytes.
+ *
+ * pci_init() also takes a one-pass inventory of every function, so the
+ * rest of csmwrap can look devices up instead of probing config space.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "clock.h"
+#include "io.h"
+#include "pci.h"
+#include "edk2/MemoryMappedConfigurationSpaceAccessTable.h"
+
+#include <uacpi/tables.h>
+
+#define PCI_MAX_ECAM_REGIONS    16
+#define PCI_LEGACY_CFG_SIZE     0x100
+#define PCI_EXT_CFG_SIZE        0x1000
+#define PCI_BENCH_ITERATIONS    1000
+#define PCI_STATUS_CAPABILITY   (1 << 4)
+#define PCI_CAP_ID_MSIX         0x11
+#define PCI_BAR_IO              (1 << 0)
+#define PCI_BAR_TYPE_MASK       (3 << 1)
+#define PCI_BAR_TYPE_64         (2 << 1)
+/* Bound capability walks against malformed lists */
+#define PCI_CAP_LIMIT           48
+#define PCI_ECAP_LIMIT          ((PCI_EXT_CFG_SIZE - PCI_LEGACY_CFG_SIZE) / 8)
+
+struct ecam_region {
+    uintptr_t base;
+    uint16_t seg;
+    uint8_t start_bus;
+    uint8_t end_bus;
+};
+
+static struct ecam_region ecam_regions[PCI_MAX_ECAM_REGIONS];
+static size_t ecam_region_count;
+
+static struct pci_device *pci_devices;
+static size_t pci_device_count;
+static size_t pci_device_capacity;
+
+static void *ecam_address(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset)
+{
+    if (offset >= PCI_EXT_CFG_SIZE) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < ecam_region_count; i++) {
+        struct ecam_region *r = &ecam_regions[i];
+
+        if (r->seg == seg && bus >= r->start_bus && bus <= r->end_bus) {
+            /* The window base corresponds to bus 0, even if the range starts later */
+            return (void *)(r->base + ((uintptr_t)bus << 20) + ((uintptr_t)dev << 15) +
+                            ((uintptr_t)func << 12) + offset);
+        }
+    }
+
+    return NULL;
+}
+
+/* Port I/O reaches segment 0 and the legacy header only */
+static bool legacy_reachable(uint16_t seg, uint16_t offset)
+{
+    return seg == 0 && offset < PCI_LEGACY_CFG_SIZE;
+}
+
+uint8_t pci_read8(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset)
+{
+    void *addr = ecam_address(seg, bus, dev, func, offset);
+
+    if (addr != NULL) {
+        return readb(addr);
+    }
+    if (!legacy_reachable(seg, offset)) {
+        return 0xff;
+    }
+    return pciConfigReadByte(bus, dev, func, offset);
+}
+
+uint16_t pci_read16(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset)
+{
+    void *addr = ecam_address(seg, bus, dev, func, offset);
+
+    if (addr != NULL) {
+        return readw(addr);
+    }
+    if (!legacy_reachable(seg, offset)) {
+        return 0xffff;
+    }
+    return pciConfigReadWord(bus, dev, func, offset);
+}
+
+uint32_t pci_read32(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset)
+{
+    void *addr = ecam_address(seg, bus, dev, func, offset);
+
+    if (addr != NULL) {
+        return readl(addr);
+    }
+    if (!legacy_reachable(seg, offset)) {
+        return 0xffffffff;
+    }
+    return pciConfigReadDWord(bus, dev, func, offset);
+}
+
+void pci_write8(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset, uint8_t val)
+{
+    void *addr = ecam_address(seg, bus, dev, func, offset);
+
+    if (addr != NULL) {
+        writeb(addr, val);
+    } else if (legacy_reachable(seg, offset)) {
+        pciConfigWriteByte(bus, dev, func, offset, val);
+    }
+}
+
+void pci_write16(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset, uint16_t val)
+{
+    void *addr = ecam_address(seg, bus, dev, func, offset);
+
+    if (addr != NULL) {
+        writew(addr, val);
+    } else if (legacy_reachable(seg, offset)) {
+        pciConfigWriteWord(bus, dev, func, offset, val);
+    }
+}
+
+void pci_write32(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset, uint32_t val)
+{
+    void *addr = ecam_address(seg, bus, dev, func, offset);
+
+    if (addr != NULL) {
+        writel(addr, val);
+    } else if (legacy_reachable(seg, offset)) {
+        pciConfigWriteDWord(bus, dev, func, offset, val);
+    }
+}
+
+uint64_t pci_ecam_base(void)
+{
+    for (size_t i = 0; i < ecam_region_count; i++) {
+        if (ecam_regions[i].seg == 0 && ecam_regions[i].start_bus == 0) {
+            return ecam_regions[i].base;
+        }
+    }
+
+    return 0;
+}
+
+static void pci_parse_mcfg(void)
+{
+    EFI_ACPI_MEMORY_MAPPED_CONFIGURATION_BASE_ADDRESS_TABLE_HEADER *mcfg;
+    EFI_ACPI_MEMORY_MAPPED_ENHANCED_CONFIGURATION_SPACE_BASE_ADDRESS_ALLOCATION_STRUCTURE *entry;
+    uacpi_table table;
+
+    if (uacpi_table_find_by_signature("MCFG", &table) != UACPI_STATUS_OK) {
+        printf_verbose("PCI: no MCFG, using port I/O config access\n");
+        return;
+    }
+
+    mcfg = table.ptr;
+    entry = (void *)(mcfg + 1);
+    size_t count = (mcfg->Header.Length - sizeof(*mcfg)) / sizeof(*entry);
+
+    for (size_t i = 0; i < count && ecam_region_count < PCI_MAX_ECAM_REGIONS; i++, entry++) {
+        uint64_t end = entry->BaseAddress + ((uint64_t)(entry->EndBusNumber + 1) << 20);
+
+        /* Not reachable from a 32-bit build */
+        if (end - 1 > UINTPTR_MAX || entry->EndBusNumber < entry->StartBusNumber) {
+            printf("PCI: skipping ECAM window %llx for segment %u\n",
+                   (unsigned long long)entry->BaseAddress, entry->PciSegmentGroupNumber);
+            continue;
+        }
+
+        /* Keep the regions sorted, so the inventory comes out sorted too */
+        size_t pos = ecam_region_count++;
+        while (pos > 0 &&
+               (ecam_regions[pos - 1].seg > entry->PciSegmentGroupNumber ||
+                (ecam_regions[pos - 1].seg == entry->PciSegmentGroupNumber &&
+                 ecam_regions[pos - 1].start_bus > entry->StartBusNumber))) {
+            ecam_regions[pos] = ecam_regions[pos - 1];
+            pos--;
+        }
+
+        struct ecam_region *r = &ecam_regions[pos];
+        r->base = entry->BaseAddress;
+        r->seg = entry->PciSegmentGroupNumber;
+        r->start_bus = entry->StartBusNumber;
+        r->end_bus = entry->EndBusNumber;
+
+        printf_verbose("PCI: ECAM %04x:[%02x-%02x] at %llx\n",
+                       r->seg, r->start_bus, r->end_bus,
+                       (unsigned long long)entry->BaseAddress);
+    }
+
+    uacpi_table_unref(&table);
+}
+
+/* Compare the cost of a config read through ECAM and through port I/O */
+static void pci_benchmark(void)
+{
+    void *addr = ecam_address(0, 0, 0, 0, 0);
+    uint64_t start, ecam_ns, port_ns;
+    volatile uint32_t sink;
+
+    if (addr == NULL) {
+        return;
+    }
+
+    start = clock_ns();
+    for (int i = 0; i < PCI_BENCH_ITERATIONS; i++) {
+        sink = readl(addr);
+    }
+    ecam_ns = clock_ns() - start;
+
+    start = clock_ns();
+    for (int i = 0; i < PCI_BENCH_ITERATIONS; i++) {
+        sink = pciConfigReadDWord(0, 0, 0, 0);
+    }
+    port_ns = clock_ns() - start;
+    (void)sink;
+
+    printf("PCI: config read %u ns via ECAM, %u ns via port I/O\n",
+           (uint32_t)(ecam_ns / PCI_BENCH_ITERATIONS), (uint32_t)(port_ns / PCI_BENCH_ITERATIONS));
+}
+
+static struct pci_device *pci_add_device(void)
+{
+    if (pci_device_count == pci_device_capacity) {
+        size_t capacity = pci_device_capacity ? pci_device_capacity * 2 : 64;
+        struct pci_device *devices;
+
+        if (gBS->AllocatePool(EfiLoaderData, capacity * sizeof(*devices), (void **)&devices) != EFI_SUCCESS) {
+            return NULL;
+        }
+        if (pci_devices != NULL) {
+            memcpy(devices, pci_devices, pci_device_count * sizeof(*devices));
+            gBS->FreePool(pci_devices);
+        }
+        pci_devices = devices;
+        pci_device_capacity = capacity;
+    }
+
+    struct pci_device *pdev = &pci_devices[pci_device_count++];
+    memset(pdev, 0, sizeof(*pdev));
+    return pdev;
+}
+
+static void pci_scan_caps(struct pci_device *pdev)
+{
+    if (!(pci_dev_read16(pdev, PCI_PRIMARY_STATUS_OFFSET) & PCI_STATUS_CAPABILITY)) {
+        return;
+    }
+
+    uint8_t ptr = pci_dev_read8(pdev, pdev->header_type == HEADER_TYPE_CARDBUS_BRIDGE ?
+                                      0x14 : PCI_CAPBILITY_POINTER_OFFSET);
+    for (int i = 0; i < PCI_CAP_LIMIT && ptr >= 0x40; i++) {
+        ptr &= ~3;
+        switch (pci_dev_read8(pdev, ptr)) {
+            case EFI_PCI_CAPABILITY_ID_PMI:
+                pdev->cap_pm = ptr;
+                break;
+            case EFI_PCI_CAPABILITY_ID_MSI:
+                pdev->cap_msi = ptr;
+                break;
+            case PCI_CAP_ID_MSIX:
+                pdev->cap_msix = ptr;
+                break;
+            case EFI_PCI_CAPABILITY_ID_PCIEXP:
+                pdev->cap_pcie = ptr;
+                break;
+        }
+        ptr = pci_dev_read8(pdev, ptr + 1);
+    }
+
+    /* Extended capabilities, PCIe behind ECAM only */
+    if (pdev->cap_pcie == 0 || ecam_address(pdev->seg, pdev->bus, pdev->dev, pdev->func, 0) == NULL) {
+        return;
+    }
+
+    uint16_t eptr = PCI_LEGACY_CFG_SIZE;
+    for (int i = 0; i < PCI_ECAP_LIMIT && eptr >= PCI_LEGACY_CFG_SIZE; i++) {
+        uint32_t header = pci_dev_read32(pdev, eptr);
+
+        if (header == 0 || header == 0xffffffff) {
+            break;
+        }
+        switch (header & 0xffff) {
+            case PCI_EXPRESS_EXTENDED_CAPABILITY_ADVANCED_ERROR_REPORTING_ID:
+                pdev->ecap_aer = eptr;
+                break;
+            case PCI_EXPRESS_EXTENDED_CAPABILITY_L1_PM_SUBSTATES_ID:
+                pdev->ecap_l1ss = eptr;
+                break;
+        }
+        eptr = (header >> 20) & 0xffc;
+    }
+}
+
+static void pci_scan_function(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint32_t id)
+{
+    struct pci_device *pdev = pci_add_device();
+
+    if (pdev == NULL) {
+        return;
+    }
+
+    pdev->seg = seg;
+    pdev->bus = bus;
+    pdev->dev = dev;
+    pdev->func = func;
+    pdev->vendor_id = id & 0xffff;
+    pdev->device_id = id >> 16;
+
+    uint32_t class = pci_dev_read32(pdev, PCI_REVISION_ID_OFFSET);
+    pdev->revision = class & 0xff;
+    pdev->prog_if = (class >> 8) & 0xff;
+    pdev->subclass = (class >> 16) & 0xff;
+    pdev->class_code = class >> 24;
+    pdev->header_type = pci_dev_read8(pdev, PCI_HEADER_TYPE_OFFSET) & ~HEADER_TYPE_MULTI_FUNCTION;
+
+    int bars = 0;
+    if (pdev->header_type == HEADER_TYPE_DEVICE) {
+        bars = 6;
+    } else if (pdev->header_type == HEADER_TYPE_PCI_TO_PCI_BRIDGE) {
+        bars = 2;
+        pdev->secondary_bus = pci_dev_read8(pdev, PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET);
+        pdev->subordinate_bus = pci_dev_read8(pdev, PCI_BRIDGE_SUBORDINATE_BUS_REGISTER_OFFSET);
+    }
+    for (int i = 0; i < bars; i++) {
+        pdev->bar[i] = pci_dev_read32(pdev, PCI_BASE_ADDRESSREG_OFFSET + i * 4);
+    }
+
+    pci_scan_caps(pdev);
+}
+
+static bool pci_present(uint32_t id)
+{
+    return (id & 0xffff) != 0xffff && (id & 0xffff) != 0;
+}
+
+/* Brute force the bus range, functions 1-7 only where function 0 says they exist */
+static void pci_scan_buses(uint16_t seg, unsigned int start_bus, unsigned int end_bus)
+{
+    for (unsigned int bus = start_bus; bus <= end_bus; bus++) {
+        for (uint8_t dev = 0; dev < 32; dev++) {
+            uint32_t id = pci_read32(seg, bus, dev, 0, PCI_VENDOR_ID_OFFSET);
+
+            if (!pci_present(id)) {
+                continue;
+            }
+
+            uint8_t functions = 1;
+            if (pci_read8(seg, bus, dev, 0, PCI_HEADER_TYPE_OFFSET) & HEADER_TYPE_MULTI_FUNCTION) {
+                functions = 8;
+            }
+
+            for (uint8_t func = 0; func < functions; func++) {
+                if (func != 0) {
+                    id = pci_read32(seg, bus, dev, func, PCI_VENDOR_ID_OFFSET);
+                    if (!pci_present(id)) {
+                        continue;
+                    }
+                }
+                pci_scan_function(seg, bus, dev, func, id);
+            }
+        }
+    }
+}
+
+static void pci_link_parents(void)
+{
+    for (size_t i = 0; i < pci_device_count; i++) {
+        struct pci_device *bridge = &pci_devices[i];
+
+        if (bridge->header_type != HEADER_TYPE_PCI_TO_PCI_BRIDGE || bridge->secondary_bus == 0) {
+            continue;
+        }
+
+        for (size_t j = 0; j < pci_device_count; j++) {
+            if (pci_devices[j].seg == bridge->seg && pci_devices[j].bus == bridge->secondary_bus) {
+                pci_devices[j].parent = bridge;
+            }
+        }
+    }
+}
+
+static void pci_scan(void)
+{
+    uint64_t start = clock_ns();
+
+    if (ecam_region_count == 0) {
+        pci_scan_buses(0, 0, 255);
+    }
+    for (size_t i = 0; i < ecam_region_count; i++) {
+        pci_scan_buses(ecam_regions[i].seg, ecam_regions[i].start_bus, ecam_regions[i].end_bus);
+    }
+    pci_link_parents();
+
+    printf_verbose("PCI: %u functions, last bus %02x, scanned in %u us\n",
+                   (uint32_t)pci_device_count, pci_last_bus(),
+                   (uint32_t)((clock_ns() - start) / 1000));
+
+    if (gConfig.log_level >= LOG_DEBUG) {
+        for (size_t i = 0; i < pci_device_count; i++) {
+            struct pci_device *pdev = &pci_devices[i];
+
+            printf("  %04x:%02x:%02x.%x %04x:%04x class %02x%02x%02x\n",
+                   pdev->seg, pdev->bus, pdev->dev, pdev->func,
+                   pdev->vendor_id, pdev->device_id,
+                   pdev->class_code, pdev->subclass, pdev->prog_if);
+        }
+    }
+}
+
+struct pci_device *pci_get_devices(size_t *count)
+{
+    *count = pci_device_count;
+    return pci_devices;
+}
+
+/* The inventory is sorted by segment and BDF */
+struct pci_device *pci_find_device(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func)
+{
+    uint32_t key = (uint32_t)seg << 16 | bus << 8 | dev << 3 | func;
+    size_t lo = 0, hi = pci_device_count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        struct pci_device *pdev = &pci_devices[mid];
+        uint32_t mid_key = (uint32_t)pdev->seg << 16 | pdev->bus << 8 | pdev->dev << 3 | pdev->func;
+
+        if (mid_key == key) {
+            return pdev;
+        }
+        if (mid_key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
+bool pci_is_inventory_device(const struct pci_device *pdev)
+{
+    return pdev >= pci_devices && pdev < pci_devices + pci_device_count;
+}
+
+uint8_t pci_last_bus(void)
+{
+    uint8_t last = 0;
+
+    for (size_t i = 0; i < pci_device_count && pci_devices[i].seg == 0; i++) {
+        if (pci_devices[i].bus > last) {
+            last = pci_devices[i].bus;
+        }
+        if (pci_devices[i].subordinate_bus > last) {
+            last = pci_devices[i].subordinate_bus;
+        }
+    }
+
+    return last;
+}
+
+uintptr_t pci_dev_mmio_bar(const struct pci_device *pdev, int index)
+{
+    if (pdev->header_type != HEADER_TYPE_DEVICE || index < 0 || index >= 6 ||
+        (pdev->bar[index] & PCI_BAR_IO)) {
+        return 0;
+    }
+
+    uint64_t addr = pdev->bar[index] & ~(uint64_t)0xf;
+    if ((pdev->bar[index] & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64) {
+        if (index == 5) {
+            return 0;
+        }
+        addr |= (uint64_t)pdev->bar[index + 1] << 32;
+    }
+
+    if (addr > UINTPTR_MAX) {
+        return 0;
+    }
+    return addr;
+}
+
+uint16_t pci_dev_io_bar(const struct pci_device *pdev, int index)
+{
+    if (pdev->header_type != HEADER_TYPE_DEVICE || index < 0 || index >= 6 ||
+        !(pdev->bar[index] & PCI_BAR_IO)) {
+        return 0;
+    }
+    return pdev->bar[index] & 0xfffc;
+}
+
+void pci_init(void)
+{
+    pci_parse_mcfg();
+    pci_scan();
+
+    if (gConfig.log_level >= LOG_DEBUG) {
+        pci_benchmark();
+    }
+}
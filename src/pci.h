@@ -0,0 +1,91 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* One entry per function found at pci_init() time */
+struct pci_device {
+    uint16_t seg;
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+    uint8_t header_type;        /* Without the multi-function bit */
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t revision;
+    uint8_t prog_if;
+    uint8_t subclass;
+    uint8_t class_code;
+
+    /* Bridges only */
+    uint8_t secondary_bus;
+    uint8_t subordinate_bus;
+
+    /* Capability offsets, 0 if absent */
+    uint8_t cap_pm;
+    uint8_t cap_msi;
+    uint8_t cap_msix;
+    uint8_t cap_pcie;
+    uint16_t ecap_aer;
+    uint16_t ecap_l1ss;
+
+    uint32_t bar[6];
+
+    /* Bridge leading to our bus, NULL on a root bus */
+    struct pci_device *parent;
+};
+
+void pci_init(void);
+
+uint8_t pci_read8(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset);
+uint16_t pci_read16(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset);
+uint32_t pci_read32(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset);
+void pci_write8(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset, uint8_t val);
+void pci_write16(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset, uint16_t val);
+void pci_write32(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset, uint32_t val);
+
+/* ECAM window for segment 0 that covers bus 0, or 0 if config space is port I/O only */
+uint64_t pci_ecam_base(void);
+
+struct pci_device *pci_get_devices(size_t *count);
+struct pci_device *pci_find_device(uint16_t seg, uint8_t bus, uint8_t dev, uint8_t func);
+bool pci_is_inventory_device(const struct pci_device *pdev);
+/* Highest bus number in use on segment 0 */
+uint8_t pci_last_bus(void);
+/* BAR addresses as inventoried, 0 if the BAR is the wrong kind, unassigned or unreachable */
+uintptr_t pci_dev_mmio_bar(const struct pci_device *pdev, int index);
+uint16_t pci_dev_io_bar(const struct pci_device *pdev, int index);
+
+static inline uint8_t pci_dev_read8(const struct pci_device *pdev, uint16_t offset)
+{
+    return pci_read8(pdev->seg, pdev->bus, pdev->dev, pdev->func, offset);
+}
+
+static inline uint16_t pci_dev_read16(const struct pci_device *pdev, uint16_t offset)
+{
+    return pci_read16(pdev->seg, pdev->bus, pdev->dev, pdev->func, offset);
+}
+
+static inline uint32_t pci_dev_read32(const struct pci_device *pdev, uint16_t offset)
+{
+    return pci_read32(pdev->seg, pdev->bus, pdev->dev, pdev->func, offset);
+}
+
+static inline void pci_dev_write8(const struct pci_device *pdev, uint16_t offset, uint8_t val)
+{
+    pci_write8(pdev->seg, pdev->bus, pdev->dev, pdev->func, offset, val);
+}
+
+static inline void pci_dev_write16(const struct pci_device *pdev, uint16_t offset, uint16_t val)
+{
+    pci_write16(pdev->seg, pdev->bus, pdev->dev, pdev->func, offset, val);
+}
+
+static inline void pci_dev_write32(const struct pci_device *pdev, uint16_t offset, uint32_t val)
+{
+    pci_write32(pdev->seg, pdev->bus, pdev->dev, pdev->func, offset, val);
+}
+
+#endif
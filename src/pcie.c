@@ -0,0 +1,306 @@
+/*
+ * PCIe link power management policy.
+ *
+ * Legacy OSes have no ASPM driver, so links keep whatever power saving
+ * setup firmware left, and every L0s/L1 exit lands on NVMe and NIC
+ * transactions as extra latency. Apply a fixed policy per link instead,
+ * with the downstream port and every function below it kept in agreement.
+ *
+ * Payload sizes get the same treatment per root port hierarchy, since
+ * nothing after us retunes what UEFI drivers left at 128 bytes.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "pci.h"
+#include "pcie.h"
+
+#define PCIE_ASPM_L0S           (1 << 0)
+#define PCIE_ASPM_L1            (1 << 1)
+/* PCI-PM and ASPM L1.1/L1.2 enables in L1 PM Substates Control 1 */
+#define PCIE_L1SS_CTL1_ENABLES  0xf
+#define PCIE_SIZE_BYTES(v)      (128u << (v))
+/* Bound parent walks against bridges that claim their own bus */
+#define PCIE_MAX_DEPTH          256
+
+#define PCIE_CAP_REG(pdev, reg) ((pdev)->cap_pcie + offsetof(PCI_CAPABILITY_PCIEXP, reg))
+#define PCIE_L1SS_CTL1_REG(pdev) \
+    ((pdev)->ecap_l1ss + offsetof(PCI_EXPRESS_EXTENDED_CAPABILITIES_L1_PM_SUBSTATES, Control1))
+
+static const char *const aspm_names[] = { "off", "L0s", "L1", "L0s L1" };
+
+static uint8_t pcie_port_type(const struct pci_device *pdev)
+{
+    PCI_REG_PCIE_CAPABILITY cap;
+
+    cap.Uint16 = pci_dev_read16(pdev, PCIE_CAP_REG(pdev, Capability));
+    return cap.Bits.DevicePortType;
+}
+
+/* The ports that own the upstream end of a physical link */
+static bool pcie_is_link_port(const struct pci_device *pdev)
+{
+    if (pdev->cap_pcie == 0 || pdev->header_type != HEADER_TYPE_PCI_TO_PCI_BRIDGE) {
+        return false;
+    }
+
+    switch (pcie_port_type(pdev)) {
+        case PCIE_DEVICE_PORT_TYPE_ROOT_PORT:
+        case PCIE_DEVICE_PORT_TYPE_DOWNSTREAM_PORT:
+        case PCIE_DEVICE_PORT_TYPE_PCI_TO_PCIE_BRIDGE:
+            return true;
+    }
+    return false;
+}
+
+static bool pcie_is_link_child(const struct pci_device *pdev, const struct pci_device *port)
+{
+    return pdev->parent == port && pdev->cap_pcie != 0;
+}
+
+static uint8_t pcie_get_aspm(const struct pci_device *pdev)
+{
+    PCI_REG_PCIE_LINK_CONTROL ctl;
+
+    ctl.Uint16 = pci_dev_read16(pdev, PCIE_CAP_REG(pdev, LinkControl));
+    return ctl.Bits.AspmControl;
+}
+
+static void pcie_set_aspm(const struct pci_device *pdev, uint8_t aspm)
+{
+    PCI_REG_PCIE_LINK_CONTROL ctl;
+
+    ctl.Uint16 = pci_dev_read16(pdev, PCIE_CAP_REG(pdev, LinkControl));
+    if (ctl.Bits.AspmControl != aspm) {
+        ctl.Bits.AspmControl = aspm;
+        pci_dev_write16(pdev, PCIE_CAP_REG(pdev, LinkControl), ctl.Uint16);
+    }
+}
+
+static uint32_t pcie_get_l1ss(const struct pci_device *pdev)
+{
+    if (pdev->ecap_l1ss == 0) {
+        return 0;
+    }
+    return pci_dev_read32(pdev, PCIE_L1SS_CTL1_REG(pdev)) & PCIE_L1SS_CTL1_ENABLES;
+}
+
+static void pcie_clear_l1ss(const struct pci_device *pdev)
+{
+    if (pcie_get_l1ss(pdev) != 0) {
+        uint32_t ctl1 = pci_dev_read32(pdev, PCIE_L1SS_CTL1_REG(pdev));
+        pci_dev_write32(pdev, PCIE_L1SS_CTL1_REG(pdev), ctl1 & ~PCIE_L1SS_CTL1_ENABLES);
+    }
+}
+
+/* CLKREQ# clock removal, only defined on upstream ports and endpoints */
+static bool pcie_get_clkreq(const struct pci_device *pdev)
+{
+    PCI_REG_PCIE_LINK_CONTROL ctl;
+
+    ctl.Uint16 = pci_dev_read16(pdev, PCIE_CAP_REG(pdev, LinkControl));
+    return ctl.Bits.ClockPowerManagement;
+}
+
+static void pcie_clear_clkreq(const struct pci_device *pdev)
+{
+    PCI_REG_PCIE_LINK_CONTROL ctl;
+
+    ctl.Uint16 = pci_dev_read16(pdev, PCIE_CAP_REG(pdev, LinkControl));
+    if (ctl.Bits.ClockPowerManagement) {
+        ctl.Bits.ClockPowerManagement = 0;
+        pci_dev_write16(pdev, PCIE_CAP_REG(pdev, LinkControl), ctl.Uint16);
+    }
+}
+
+/* Returns true if anything on the link changed */
+static bool pcie_apply_link(struct pci_device *port, struct pci_device *devices, size_t count,
+                            enum aspm_policy policy)
+{
+    uint8_t old_aspm = pcie_get_aspm(port);
+    uint8_t common_aspm = old_aspm;
+    uint32_t l1ss = pcie_get_l1ss(port);
+    bool clkreq = false;
+    bool mismatch = false;
+    size_t children = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        struct pci_device *child = &devices[i];
+
+        if (!pcie_is_link_child(child, port)) {
+            continue;
+        }
+        uint8_t aspm = pcie_get_aspm(child);
+        mismatch |= aspm != old_aspm;
+        common_aspm &= aspm;
+        l1ss |= pcie_get_l1ss(child);
+        clkreq |= pcie_get_clkreq(child);
+        children++;
+    }
+
+    /* Empty slot, or the far end is not PCIe */
+    if (children == 0) {
+        return false;
+    }
+
+    /* L1 stays only where both ends already had it, L0s and substates never do */
+    uint8_t target = policy == ASPM_POLICY_L1 ? common_aspm & PCIE_ASPM_L1 : 0;
+
+    if (!mismatch && old_aspm == target && l1ss == 0 && !clkreq) {
+        return false;
+    }
+
+    /* Disable ASPM on the downstream component first, the port last */
+    for (size_t i = 0; i < count; i++) {
+        if (pcie_is_link_child(&devices[i], port)) {
+            pcie_set_aspm(&devices[i], 0);
+        }
+    }
+    pcie_set_aspm(port, 0);
+
+    /* L1 substate enables may only change while ASPM L1 is off */
+    for (size_t i = 0; i < count; i++) {
+        if (pcie_is_link_child(&devices[i], port)) {
+            pcie_clear_l1ss(&devices[i]);
+            pcie_clear_clkreq(&devices[i]);
+        }
+    }
+    pcie_clear_l1ss(port);
+
+    /* Enabling goes the other way round */
+    if (target != 0) {
+        pcie_set_aspm(port, target);
+        for (size_t i = 0; i < count; i++) {
+            if (pcie_is_link_child(&devices[i], port)) {
+                pcie_set_aspm(&devices[i], target);
+            }
+        }
+    }
+
+    printf_verbose("PCIe: %04x:%02x:%02x.%x link ASPM %s%s -> %s, L1SS %x -> 0%s\n",
+                   port->seg, port->bus, port->dev, port->func,
+                   aspm_names[old_aspm], mismatch ? " (mismatched)" : "",
+                   aspm_names[target], l1ss, clkreq ? ", CLKREQ# off" : "");
+    return true;
+}
+
+void pcie_apply_aspm_policy(void)
+{
+    enum aspm_policy policy = gConfig.aspm_policy;
+    struct pci_device *devices;
+    size_t count;
+    uint32_t links = 0, changed = 0;
+
+    if (policy == ASPM_POLICY_FIRMWARE) {
+        return;
+    }
+
+    devices = pci_get_devices(&count);
+    for (size_t i = 0; i < count; i++) {
+        if (!pcie_is_link_port(&devices[i])) {
+            continue;
+        }
+        links++;
+        if (pcie_apply_link(&devices[i], devices, count, policy)) {
+            changed++;
+        }
+    }
+
+    printf("PCIe: ASPM policy changed %u of %u links\n", changed, links);
+}
+
+static bool pcie_in_hierarchy(const struct pci_device *pdev, const struct pci_device *root)
+{
+    const struct pci_device *p = pdev;
+
+    for (int depth = 0; p != NULL && depth < PCIE_MAX_DEPTH; depth++, p = p->parent) {
+        if (p == root) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pcie_tune_hierarchy(struct pci_device *root, struct pci_device *devices, size_t count,
+                                bool dry_run)
+{
+    PCI_REG_PCIE_DEVICE_CAPABILITY cap;
+    PCI_REG_PCIE_DEVICE_CONTROL ctl, old;
+    uint8_t mps = PCIE_MAX_PAYLOAD_SIZE_4096B;
+
+    /* Every device in the hierarchy has to accept what any other may send it */
+    for (size_t i = 0; i < count; i++) {
+        struct pci_device *pdev = &devices[i];
+
+        if (pdev->cap_pcie == 0 || !pcie_in_hierarchy(pdev, root)) {
+            continue;
+        }
+        cap.Uint32 = pci_dev_read32(pdev, PCIE_CAP_REG(pdev, DeviceCapability));
+        if (cap.Bits.MaxPayloadSize < mps) {
+            mps = cap.Bits.MaxPayloadSize;
+        }
+    }
+
+    /* Firmware clears relaxed ordering on root ports that mishandle it */
+    ctl.Uint16 = pci_dev_read16(root, PCIE_CAP_REG(root, DeviceControl));
+    uint8_t relaxed = ctl.Bits.RelaxedOrdering;
+
+    for (size_t i = 0; i < count; i++) {
+        struct pci_device *pdev = &devices[i];
+
+        if (pdev->cap_pcie == 0 || !pcie_in_hierarchy(pdev, root)) {
+            continue;
+        }
+
+        old.Uint16 = pci_dev_read16(pdev, PCIE_CAP_REG(pdev, DeviceControl));
+        ctl = old;
+        ctl.Bits.MaxPayloadSize = mps;
+        /* Bridges forward requests but never size their own */
+        if (pdev->header_type != HEADER_TYPE_PCI_TO_PCI_BRIDGE && ctl.Bits.MaxReadRequestSize < mps) {
+            ctl.Bits.MaxReadRequestSize = mps;
+        }
+        ctl.Bits.RelaxedOrdering = relaxed;
+        /* Legacy drivers expect coherent DMA and never flush caches for it */
+        ctl.Bits.NoSnoop = 0;
+
+        /* A dry run exists to be read, so it always prints */
+        printf_level(dry_run ? LOG_INFO : LOG_VERBOSE,
+               "PCIe: %04x:%02x:%02x.%x MPS %u -> %u, MRRS %u -> %u, RO %u -> %u, NS %u -> %u\n",
+               pdev->seg, pdev->bus, pdev->dev, pdev->func,
+               PCIE_SIZE_BYTES(old.Bits.MaxPayloadSize), PCIE_SIZE_BYTES(ctl.Bits.MaxPayloadSize),
+               PCIE_SIZE_BYTES(old.Bits.MaxReadRequestSize), PCIE_SIZE_BYTES(ctl.Bits.MaxReadRequestSize),
+               old.Bits.RelaxedOrdering, ctl.Bits.RelaxedOrdering,
+               old.Bits.NoSnoop, ctl.Bits.NoSnoop);
+
+        if (!dry_run && ctl.Uint16 != old.Uint16) {
+            pci_dev_write16(pdev, PCIE_CAP_REG(pdev, DeviceControl), ctl.Uint16);
+        }
+    }
+}
+
+void pcie_tune_payload(void)
+{
+    enum mps_policy policy = gConfig.mps_policy;
+    struct pci_device *devices;
+    size_t count;
+    uint32_t hierarchies = 0;
+
+    if (policy == MPS_POLICY_FIRMWARE) {
+        return;
+    }
+
+    devices = pci_get_devices(&count);
+    for (size_t i = 0; i < count; i++) {
+        struct pci_device *root = &devices[i];
+
+        if (root->cap_pcie == 0 || root->parent != NULL ||
+            pcie_port_type(root) != PCIE_DEVICE_PORT_TYPE_ROOT_PORT) {
+            continue;
+        }
+        pcie_tune_hierarchy(root, devices, count, policy == MPS_POLICY_DRY_RUN);
+        hierarchies++;
+    }
+
+    printf("PCIe: payload sizes %s for %u root ports\n",
+           policy == MPS_POLICY_DRY_RUN ? "reported" : "tuned", hierarchies);
+}
@@ -0,0 +1,12 @@
+#ifndef PCIE_H
+#define PCIE_H
+
+/* Apply gConfig.aspm_policy to every PCIe link, both ends together */
+void pcie_apply_aspm_policy(void);
+/*
+ * Program the largest Max Payload Size every device under a root port
+ * supports, plus MRRS and the relaxed ordering/no snoop enables to match.
+ */
+void pcie_tune_payload(void);
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ * CPU performance policy applied before handoff.
+ *
+ * Legacy OSes have no P-state or HWP driver, so whatever request we
+ * leave in the MSRs is what they run at. The policy is applied on every
+ * CPU through MP services, then APERF/MPERF tell us what we got.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "clock.h"
+#include "io.h"
+#include "mp.h"
+#include "perf.h"
+
+#define MSR_IA32_MPERF              0xE7
+#define MSR_IA32_APERF              0xE8
+/* Model specific, only touched on the models in core_msr_models */
+#define MSR_PLATFORM_INFO           0xCE
+#define MSR_IA32_PERF_CTL           0x199
+#define PERF_CTL_TURBO_DISENGAGE    (1ULL << 32)
+#define MSR_IA32_MISC_ENABLE        0x1A0
+#define MISC_ENABLE_EIST            (1ULL << 16)
+#define MISC_ENABLE_TURBO_DISABLE   (1ULL << 38)
+#define MSR_TURBO_RATIO_LIMIT       0x1AD
+#define MSR_IA32_ENERGY_PERF_BIAS   0x1B0
+#define EPB_PERFORMANCE             0
+#define MSR_POWER_CTL               0x1FC
+#define POWER_CTL_C1E               (1 << 1)
+#define MSR_IA32_PM_ENABLE          0x770
+#define MSR_IA32_HWP_CAPABILITIES   0x771
+#define MSR_IA32_HWP_REQUEST        0x774
+
+#define MSR_AMD_HWCR                0xC0010015
+#define HWCR_CPB_DIS                (1 << 25)
+#define MSR_AMD_PSTATE_CUR_LIMIT    0xC0010061
+#define MSR_AMD_PSTATE_CTL          0xC0010062
+
+/* CPUID 1 ECX */
+#define CPUID_1_ECX_EIST            (1 << 7)
+/* CPUID 6 EAX/ECX */
+#define CPUID_6_EAX_TURBO           (1 << 1)
+#define CPUID_6_EAX_HWP             (1 << 7)
+#define CPUID_6_ECX_APERFMPERF      (1 << 0)
+#define CPUID_6_ECX_EPB             (1 << 3)
+/* CPUID 80000007h EDX */
+#define CPUID_80000007_EDX_HWPSTATE (1 << 7)
+#define CPUID_80000007_EDX_CPB      (1 << 9)
+/* "Genu"ineIntel, "Auth"enticAMD, "Hygo"nGenuine */
+#define CPUID_EBX_INTEL             0x756e6547
+#define CPUID_EBX_AMD               0x68747541
+#define CPUID_EBX_HYGON             0x6f677948
+
+/*
+ * Family 6 big cores that have PLATFORM_INFO, TURBO_RATIO_LIMIT and
+ * POWER_CTL: Nehalem through Arrow Lake. Older EIST parts, Atoms and
+ * Xeon Phi lack some of them and #GP.
+ */
+static const uint8_t core_msr_models[] = {
+    0x1A, 0x1E, 0x1F, 0x2E,             /* Nehalem */
+    0x25, 0x2C, 0x2F,                   /* Westmere */
+    0x2A, 0x2D,                         /* Sandy Bridge */
+    0x3A, 0x3E,                         /* Ivy Bridge */
+    0x3C, 0x3F, 0x45, 0x46,             /* Haswell */
+    0x3D, 0x47, 0x4F, 0x56,             /* Broadwell */
+    0x4E, 0x5E, 0x55,                   /* Skylake */
+    0x8E, 0x9E, 0xA5, 0xA6,             /* Kaby/Coffee/Comet Lake */
+    0x66, 0x7D, 0x7E, 0x6A, 0x6C, 0xA7, /* Cannon/Ice/Rocket Lake */
+    0x8C, 0x8D,                         /* Tiger Lake */
+    0x97, 0x9A, 0xB7, 0xBA, 0xBF,       /* Alder/Raptor Lake */
+    0x8F, 0xCF,                         /* Sapphire/Emerald Rapids */
+    0xAA, 0xAC, 0xC5, 0xC6, 0xBD,       /* Meteor/Arrow/Lunar Lake */
+};
+
+#define PERF_MAX_CPUS               256
+#define PERF_MEASURE_US             1000
+/* Let a new P-state request settle before measuring */
+#define PERF_SETTLE_US              100
+
+struct perf_features {
+    bool intel;
+    bool amd;
+    /* PLATFORM_INFO, TURBO_RATIO_LIMIT and POWER_CTL are safe to access */
+    bool core_msrs;
+    bool eist;
+    bool turbo;
+    bool hwp;
+    bool epb;
+    bool aperfmperf;
+    bool hw_pstate;
+    bool cpb;
+};
+
+static struct perf_features features;
+/* Effective MHz per CPU handle number, 0 if not measured */
+static uint32_t cpu_mhz[PERF_MAX_CPUS];
+
+static void perf_detect(struct perf_features *f)
+{
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t max_leaf;
+
+    memset(f, 0, sizeof(*f));
+
+    cpuid(0, 0, &max_leaf, &ebx, &ecx, &edx);
+    f->intel = ebx == CPUID_EBX_INTEL;
+    f->amd = ebx == CPUID_EBX_AMD || ebx == CPUID_EBX_HYGON;
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    f->eist = !!(ecx & CPUID_1_ECX_EIST);
+
+    uint32_t family = (eax >> 8) & 0xf;
+    uint32_t model = ((eax >> 4) & 0xf) | ((eax >> 12) & 0xf0);
+    if (f->intel && family == 6) {
+        for (size_t i = 0; i < sizeof(core_msr_models); i++) {
+            if (core_msr_models[i] == model) {
+                f->core_msrs = true;
+                break;
+            }
+        }
+    }
+
+    if (max_leaf >= 6) {
+        cpuid(6, 0, &eax, &ebx, &ecx, &edx);
+        f->turbo = !!(eax & CPUID_6_EAX_TURBO);
+        f->hwp = !!(eax & CPUID_6_EAX_HWP);
+        f->aperfmperf = !!(ecx & CPUID_6_ECX_APERFMPERF);
+        f->epb = !!(ecx & CPUID_6_ECX_EPB);
+    }
+
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000007) {
+        cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        f->hw_pstate = !!(edx & CPUID_80000007_EDX_HWPSTATE);
+        f->cpb = !!(edx & CPUID_80000007_EDX_CPB);
+    }
+}
+
+static void perf_apply_intel(bool turbo)
+{
+    /* HWP owns the P-state once firmware enabled it, PERF_CTL is ignored */
+    if (features.hwp && (rdmsr(MSR_IA32_PM_ENABLE) & 1)) {
+        uint64_t caps = rdmsr(MSR_IA32_HWP_CAPABILITIES);
+        uint8_t highest = caps & 0xff;
+        uint8_t guaranteed = (caps >> 8) & 0xff;
+        uint8_t perf = turbo ? highest : guaranteed;
+
+        /* min = max = perf, desired 0 (autonomous), EPP 0 (performance) */
+        wrmsr(MSR_IA32_HWP_REQUEST, perf | (uint64_t)perf << 8);
+    } else if (features.eist && (rdmsr(MSR_IA32_MISC_ENABLE) & MISC_ENABLE_EIST)) {
+        /* Without PLATFORM_INFO the best we know is the current target */
+        uint64_t ctl = rdmsr(MSR_IA32_PERF_CTL) & ~PERF_CTL_TURBO_DISENGAGE;
+        uint64_t ratio = (ctl >> 8) & 0xff;
+
+        if (features.core_msrs) {
+            ratio = (rdmsr(MSR_PLATFORM_INFO) >> 8) & 0xff;
+            ctl = ratio << 8;
+        }
+
+        if (turbo) {
+            uint64_t misc = rdmsr(MSR_IA32_MISC_ENABLE);
+            if (misc & MISC_ENABLE_TURBO_DISABLE) {
+                wrmsr(MSR_IA32_MISC_ENABLE, misc & ~MISC_ENABLE_TURBO_DISABLE);
+            }
+            /* Single core turbo ratio, the hardware clamps it to what is allowed */
+            uint64_t turbo_ratio = features.core_msrs ? rdmsr(MSR_TURBO_RATIO_LIMIT) & 0xff : 0;
+            if (turbo_ratio > ratio) {
+                ctl = turbo_ratio << 8;
+            }
+        } else if (features.turbo) {
+            ctl |= PERF_CTL_TURBO_DISENGAGE;
+        }
+        wrmsr(MSR_IA32_PERF_CTL, ctl);
+    }
+
+    /* C1E drops to the lowest P-state on every HLT, which legacy OSes do a lot */
+    if (features.core_msrs && features.turbo) {
+        wrmsr(MSR_POWER_CTL, rdmsr(MSR_POWER_CTL) & ~(uint64_t)POWER_CTL_C1E);
+    }
+}
+
+static void perf_apply_amd(bool turbo)
+{
+    if (features.cpb) {
+        uint64_t hwcr = rdmsr(MSR_AMD_HWCR);
+        if (turbo) {
+            hwcr &= ~(uint64_t)HWCR_CPB_DIS;
+        } else {
+            hwcr |= HWCR_CPB_DIS;
+        }
+        wrmsr(MSR_AMD_HWCR, hwcr);
+    }
+
+    /* Highest performance P-state the platform currently allows, usually P0 */
+    if (features.hw_pstate) {
+        wrmsr(MSR_AMD_PSTATE_CTL, rdmsr(MSR_AMD_PSTATE_CUR_LIMIT) & 0x7);
+    }
+}
+
+static uint32_t perf_measure_mhz(void)
+{
+    uint64_t tsc_hz = clock_tsc_hz();
+
+    if (!features.aperfmperf || tsc_hz == 0) {
+        return 0;
+    }
+
+    uint64_t aperf = rdmsr(MSR_IA32_APERF);
+    uint64_t mperf = rdmsr(MSR_IA32_MPERF);
+    udelay(PERF_MEASURE_US);
+    aperf = rdmsr(MSR_IA32_APERF) - aperf;
+    mperf = rdmsr(MSR_IA32_MPERF) - mperf;
+
+    if (mperf == 0) {
+        return 0;
+    }
+
+    /* MPERF ticks at the TSC rate */
+    return (uint32_t)((tsc_hz / 1000000) * aperf / mperf);
+}
+
+static VOID EFIAPI perf_apply_cpu(VOID *arg)
+{
+    enum perf_policy policy = *(enum perf_policy *)arg;
+
+    if (policy != PERF_POLICY_FIRMWARE) {
+        bool turbo = policy == PERF_POLICY_TURBO;
+
+        if (features.intel) {
+            perf_apply_intel(turbo);
+        } else if (features.amd) {
+            perf_apply_amd(turbo);
+        }
+        if (features.epb) {
+            wrmsr(MSR_IA32_ENERGY_PERF_BIAS, EPB_PERFORMANCE);
+        }
+        udelay(PERF_SETTLE_US);
+    }
+
+    size_t cpu = mp_cpu_number();
+    if (cpu < PERF_MAX_CPUS) {
+        cpu_mhz[cpu] = perf_measure_mhz();
+    }
+}
+
+void perf_apply_policy(void)
+{
+    enum perf_policy policy = gConfig.perf_policy;
+
+    /* Nothing to apply, and nobody would see the measurement */
+    if (policy == PERF_POLICY_FIRMWARE && gConfig.log_level < LOG_VERBOSE) {
+        return;
+    }
+
+    perf_detect(&features);
+    memset(cpu_mhz, 0, sizeof(cpu_mhz));
+
+    if (mp_run_on_all_cpus(perf_apply_cpu, &policy) != 0) {
+        printf("Perf: policy not applied on all CPUs\n");
+    }
+
+    uint32_t min = 0, max = 0, count = 0;
+    for (size_t i = 0; i < PERF_MAX_CPUS; i++) {
+        if (cpu_mhz[i] == 0) {
+            continue;
+        }
+        if (count == 0 || cpu_mhz[i] < min) {
+            min = cpu_mhz[i];
+        }
+        if (cpu_mhz[i] > max) {
+            max = cpu_mhz[i];
+        }
+        count++;
+        if (gConfig.log_level >= LOG_DEBUG) {
+            printf("  CPU %u: %u MHz\n", (uint32_t)i, cpu_mhz[i]);
+        }
+    }
+
+    if (count == 0) {
+        printf_verbose("Perf: no APERF/MPERF, effective frequency unknown\n");
+        return;
+    }
+
+    printf("Perf: %u of %u CPUs at %u-%u MHz (TSC %u MHz)\n", count, (uint32_t)mp_cpu_count(),
+           min, max, (uint32_t)(clock_tsc_hz() / 1000000));
+}
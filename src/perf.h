@@ -0,0 +1,7 @@
+#ifndef PERF_H
+#define PERF_H
+
+/* Apply gConfig.perf_policy on all CPUs and log the resulting frequencies */
+void perf_apply_policy(void);
+
+#endif
@@ -12,24 +12,12 @@
 
 #include <efi.h>
 #include <csmwrap.h>
+#include <console.h>
 
 static void _putchar(int character, void *extra_arg) {
     (void)extra_arg;
 
-    if (character == '\n') {
-        _putchar('\r', NULL);
-    }
-
-    CHAR16 string[2];
-    string[0] = character;
-    string[1] = 0;
-
-    if (!gST->ConOut || !gST->ConOut->OutputString) {
-        /* No console output available */
-        return;
-    }
-
-    gST->ConOut->OutputString(gST->ConOut, string);
+    console_putc(character);
 }
 
 int printf(const char *restrict fmt, ...) {
@@ -37,5 +25,6 @@ int printf(const char *restrict fmt, ...) {
     va_start(l, fmt);
     int ret = npf_vpprintf(_putchar, NULL, fmt, l);
     va_end(l);
+    console_flush();
     return ret;
 }
@@ -1,6 +1,18 @@
 #ifndef PRINTF_H
 #define PRINTF_H
 
-int printf(const char *restrict fmt, ...);
+#include <config.h>
+
+int printf(const char *restrict fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* Arguments are not even evaluated unless the runtime log level asks for it */
+#define printf_level(level, ...)                \
+    do {                                        \
+        if (gConfig.log_level >= (level)) {     \
+            printf(__VA_ARGS__);                \
+        }                                       \
+    } while (0)
+
+#define printf_verbose(...) printf_level(LOG_VERBOSE, __VA_ARGS__)
 
 #endif
@@ -0,0 +1,335 @@
+/*
+ * Pre-handoff device quiesce.
+ *
+ * ExitBootServices stops the UEFI drivers, not their hardware. Host
+ * controllers can keep running schedules and DMA into memory that is
+ * about to become SeaBIOS's, and USB controllers may still have SMM
+ * legacy keyboard emulation armed, which SeaBIOS then fights with
+ * through its reset timeouts. Hand USB over to the OS, halt what UEFI
+ * left running and clear bus mastering. SeaBIOS turns it back on for
+ * every controller it drives.
+ */
+
+#include <efi.h>
+#include "csmwrap.h"
+#include "clock.h"
+#include "io.h"
+#include "pci.h"
+#include "quiesce.h"
+
+#define PCI_COMMAND_IO              (1 << 0)
+#define PCI_COMMAND_MEMORY          (1 << 1)
+#define PCI_COMMAND_BUS_MASTER      (1 << 2)
+
+/* Firmware has this long to give up a USB controller, same as Linux */
+#define HANDOFF_TIMEOUT_US          1000000
+#define HALT_TIMEOUT_US             16000
+#define AHCI_TIMEOUT_US             500000
+
+/* xHCI */
+#define XHCI_HCCPARAMS1             0x10
+#define XHCI_EXT_CAP_LEGACY         1
+#define XHCI_USBLEGSUP_BIOS_OWNED   (1u << 16)
+#define XHCI_USBLEGSUP_OS_OWNED     (1u << 24)
+#define XHCI_USBLEGCTLSTS           4
+/* Keep the reserved bits, clear the SMI enables, ack the RW1C events */
+#define XHCI_LEGCTLSTS_KEEP         ((0x7u << 1) | (0xffu << 5) | (0x7u << 17))
+#define XHCI_LEGCTLSTS_EVENTS       (0x7u << 29)
+#define XHCI_EXT_CAP_LIMIT          64
+
+/* EHCI, the legacy support capability lives in config space */
+#define EHCI_HCCPARAMS              0x08
+#define EHCI_CAP_LEGACY             1
+#define EHCI_USBLEGSUP_BIOS_OWNED   (1u << 16)
+#define EHCI_USBLEGSUP_OS_OWNED     (1u << 24)
+#define EHCI_USBLEGCTLSTS           4
+
+/* EHCI and xHCI share the USBCMD/USBSTS run and halt bits */
+#define USB_USBCMD                  0x00
+#define USB_USBCMD_RUN              (1u << 0)
+#define USB_USBSTS                  0x04
+#define XHCI_USBSTS_HALTED          (1u << 0)
+#define EHCI_USBSTS_HALTED          (1u << 12)
+
+/* UHCI */
+#define UHCI_USBLEGSUP              0xC0
+#define UHCI_USBLEGSUP_RWC          0x8f00  /* Status bits, SMI enables all 0 */
+#define UHCI_USBCMD                 0x00
+#define UHCI_USBCMD_RUN             (1 << 0)
+
+/* OHCI */
+#define OHCI_CONTROL                0x04
+#define OHCI_CONTROL_IR             (1u << 8)
+#define OHCI_CMDSTATUS              0x08
+#define OHCI_CMDSTATUS_OCR          (1u << 3)
+#define OHCI_INTRDISABLE            0x14
+#define OHCI_INTR_MIE               (1u << 31)
+
+/* AHCI */
+#define AHCI_PI                     0x0C
+#define AHCI_PORT_BASE(p)           (0x100 + (p) * 0x80)
+#define AHCI_PXCMD                  0x18
+#define AHCI_PXCMD_ST               (1u << 0)
+#define AHCI_PXCMD_FRE              (1u << 4)
+#define AHCI_PXCMD_FR               (1u << 14)
+#define AHCI_PXCMD_CR               (1u << 15)
+
+/* NVMe */
+#define NVME_CAP                    0x00
+#define NVME_CC                     0x14
+#define NVME_CC_EN                  (1u << 0)
+#define NVME_CSTS                   0x1C
+#define NVME_CSTS_RDY               (1u << 0)
+#define NVME_TIMEOUT_UNIT_US        500000
+
+static bool wait_mmio(uint8_t *reg, uint32_t mask, uint32_t value, uint64_t timeout_us)
+{
+    uint64_t deadline = clock_ns() + timeout_us * 1000;
+
+    while ((readl(reg) & mask) != value) {
+        if (clock_ns() >= deadline) {
+            return false;
+        }
+        asm volatile ("pause");
+    }
+    return true;
+}
+
+static bool wait_config(const struct pci_device *pdev, uint16_t offset, uint32_t mask,
+                        uint32_t value, uint64_t timeout_us)
+{
+    uint64_t deadline = clock_ns() + timeout_us * 1000;
+
+    while ((pci_dev_read32(pdev, offset) & mask) != value) {
+        if (clock_ns() >= deadline) {
+            return false;
+        }
+        asm volatile ("pause");
+    }
+    return true;
+}
+
+/* MMIO register block of a controller, NULL if memory decoding is off */
+static uint8_t *quiesce_mmio(const struct pci_device *pdev, int bar)
+{
+    if (!(pci_dev_read16(pdev, PCI_COMMAND_OFFSET) & PCI_COMMAND_MEMORY)) {
+        return NULL;
+    }
+    return (uint8_t *)pci_dev_mmio_bar(pdev, bar);
+}
+
+static bool quiesce_xhci(const struct pci_device *pdev)
+{
+    uint8_t *regs = quiesce_mmio(pdev, 0);
+
+    if (regs == NULL) {
+        return false;
+    }
+
+    uint32_t ptr = (readl(regs + XHCI_HCCPARAMS1) >> 16) << 2;
+    for (int i = 0; i < XHCI_EXT_CAP_LIMIT && ptr != 0; i++) {
+        uint8_t *cap = regs + ptr;
+        uint32_t val = readl(cap);
+
+        if ((val & 0xff) == XHCI_EXT_CAP_LEGACY) {
+            if (val & XHCI_USBLEGSUP_BIOS_OWNED) {
+                writel(cap, val | XHCI_USBLEGSUP_OS_OWNED);
+                if (!wait_mmio(cap, XHCI_USBLEGSUP_BIOS_OWNED, 0, HANDOFF_TIMEOUT_US)) {
+                    printf("Quiesce: xHCI %02x:%02x.%x BIOS handoff timed out\n",
+                           pdev->bus, pdev->dev, pdev->func);
+                    /* Take it anyway, the SMIs get disabled below */
+                    writel(cap, (readl(cap) & ~XHCI_USBLEGSUP_BIOS_OWNED) | XHCI_USBLEGSUP_OS_OWNED);
+                }
+            }
+            val = readl(cap + XHCI_USBLEGCTLSTS);
+            writel(cap + XHCI_USBLEGCTLSTS, (val & XHCI_LEGCTLSTS_KEEP) | XHCI_LEGCTLSTS_EVENTS);
+            break;
+        }
+
+        uint32_t next = ((val >> 8) & 0xff) << 2;
+        if (next == 0) {
+            break;
+        }
+        ptr += next;
+    }
+
+    uint8_t *op = regs + readb(regs);
+    writel(op + USB_USBCMD, readl(op + USB_USBCMD) & ~USB_USBCMD_RUN);
+    return wait_mmio(op + USB_USBSTS, XHCI_USBSTS_HALTED, XHCI_USBSTS_HALTED, HALT_TIMEOUT_US);
+}
+
+static bool quiesce_ehci(const struct pci_device *pdev)
+{
+    uint8_t *regs = quiesce_mmio(pdev, 0);
+
+    if (regs == NULL) {
+        return false;
+    }
+
+    uint8_t eecp = (readl(regs + EHCI_HCCPARAMS) >> 8) & 0xff;
+    if (eecp >= 0x40 && (pci_dev_read32(pdev, eecp) & 0xff) == EHCI_CAP_LEGACY) {
+        if (pci_dev_read32(pdev, eecp) & EHCI_USBLEGSUP_BIOS_OWNED) {
+            /* The OS semaphore is the only byte we may write */
+            pci_dev_write8(pdev, eecp + 3, 1);
+            if (!wait_config(pdev, eecp, EHCI_USBLEGSUP_BIOS_OWNED, 0, HANDOFF_TIMEOUT_US)) {
+                printf("Quiesce: EHCI %02x:%02x.%x BIOS handoff timed out\n",
+                       pdev->bus, pdev->dev, pdev->func);
+                pci_dev_write8(pdev, eecp + 2, 0);
+            }
+        }
+        pci_dev_write32(pdev, eecp + EHCI_USBLEGCTLSTS, 0);
+    }
+
+    uint8_t *op = regs + readb(regs);
+    writel(op + USB_USBCMD, readl(op + USB_USBCMD) & ~USB_USBCMD_RUN);
+    return wait_mmio(op + USB_USBSTS, EHCI_USBSTS_HALTED, EHCI_USBSTS_HALTED, HALT_TIMEOUT_US);
+}
+
+static bool quiesce_uhci(const struct pci_device *pdev)
+{
+    pci_dev_write16(pdev, UHCI_USBLEGSUP, UHCI_USBLEGSUP_RWC);
+
+    uint16_t port = pci_dev_io_bar(pdev, 4);
+    if (port == 0 || !(pci_dev_read16(pdev, PCI_COMMAND_OFFSET) & PCI_COMMAND_IO)) {
+        return false;
+    }
+    outw(port + UHCI_USBCMD, inw(port + UHCI_USBCMD) & ~UHCI_USBCMD_RUN);
+    return true;
+}
+
+static bool quiesce_ohci(const struct pci_device *pdev)
+{
+    uint8_t *regs = quiesce_mmio(pdev, 0);
+
+    if (regs == NULL) {
+        return false;
+    }
+
+    if (readl(regs + OHCI_CONTROL) & OHCI_CONTROL_IR) {
+        writel(regs + OHCI_CMDSTATUS, OHCI_CMDSTATUS_OCR);
+        if (!wait_mmio(regs + OHCI_CONTROL, OHCI_CONTROL_IR, 0, HANDOFF_TIMEOUT_US)) {
+            printf("Quiesce: OHCI %02x:%02x.%x BIOS handoff timed out\n",
+                   pdev->bus, pdev->dev, pdev->func);
+        }
+    }
+    writel(regs + OHCI_INTRDISABLE, OHCI_INTR_MIE);
+    /* HCFS to UsbReset stops all list processing */
+    writel(regs + OHCI_CONTROL, readl(regs + OHCI_CONTROL) & OHCI_CONTROL_IR);
+    return true;
+}
+
+static bool quiesce_ahci(const struct pci_device *pdev)
+{
+    uint8_t *regs = quiesce_mmio(pdev, 5);
+    bool ok = true;
+
+    if (regs == NULL) {
+        return false;
+    }
+
+    uint32_t pi = readl(regs + AHCI_PI);
+    for (int p = 0; p < 32; p++) {
+        if (!(pi & (1u << p))) {
+            continue;
+        }
+
+        uint8_t *cmd = regs + AHCI_PORT_BASE(p) + AHCI_PXCMD;
+        /* Command list engine first, the FIS receive engine after it */
+        if (readl(cmd) & (AHCI_PXCMD_ST | AHCI_PXCMD_CR)) {
+            writel(cmd, readl(cmd) & ~AHCI_PXCMD_ST);
+            ok &= wait_mmio(cmd, AHCI_PXCMD_CR, 0, AHCI_TIMEOUT_US);
+        }
+        if (readl(cmd) & (AHCI_PXCMD_FRE | AHCI_PXCMD_FR)) {
+            writel(cmd, readl(cmd) & ~AHCI_PXCMD_FRE);
+            ok &= wait_mmio(cmd, AHCI_PXCMD_FR, 0, AHCI_TIMEOUT_US);
+        }
+    }
+    return ok;
+}
+
+static bool quiesce_nvme(const struct pci_device *pdev)
+{
+    uint8_t *regs = quiesce_mmio(pdev, 0);
+
+    if (regs == NULL) {
+        return false;
+    }
+    if (!(readl(regs + NVME_CC) & NVME_CC_EN)) {
+        return true;
+    }
+
+    /* CAP.TO is how long the controller may take to change CSTS.RDY */
+    uint64_t timeout = ((readq(regs + NVME_CAP) >> 24) & 0xff) + 1;
+    writel(regs + NVME_CC, readl(regs + NVME_CC) & ~NVME_CC_EN);
+    return wait_mmio(regs + NVME_CSTS, NVME_CSTS_RDY, 0, timeout * NVME_TIMEOUT_UNIT_US);
+}
+
+void quiesce_devices(void)
+{
+    struct pci_device *devices;
+    size_t count;
+    uint32_t stopped = 0;
+
+    devices = pci_get_devices(&count);
+    for (size_t i = 0; i < count; i++) {
+        struct pci_device *pdev = &devices[i];
+        const char *name = NULL;
+        bool ok = true;
+
+        if (pdev->header_type != HEADER_TYPE_DEVICE) {
+            continue;
+        }
+
+        if (pdev->class_code == PCI_CLASS_SERIAL && pdev->subclass == PCI_CLASS_SERIAL_USB) {
+            switch (pdev->prog_if) {
+                case PCI_IF_XHCI:
+                    name = "xHCI";
+                    ok = quiesce_xhci(pdev);
+                    break;
+                case PCI_IF_EHCI:
+                    name = "EHCI";
+                    ok = quiesce_ehci(pdev);
+                    break;
+                case PCI_IF_UHCI:
+                    name = "UHCI";
+                    ok = quiesce_uhci(pdev);
+                    break;
+                case PCI_IF_OHCI:
+                    name = "OHCI";
+                    ok = quiesce_ohci(pdev);
+                    break;
+            }
+        } else if (pdev->class_code == PCI_CLASS_MASS_STORAGE) {
+            if (pdev->subclass == PCI_CLASS_MASS_STORAGE_SATADPA &&
+                pdev->prog_if == PCI_IF_MASS_STORAGE_AHCI) {
+                name = "AHCI";
+                ok = quiesce_ahci(pdev);
+            } else if (pdev->subclass == PCI_CLASS_MASS_STORAGE_SOLID_STATE &&
+                       pdev->prog_if == PCI_IF_MASS_STORAGE_SOLID_STATE_ENTERPRISE_NVMHCI) {
+                name = "NVMe";
+                ok = quiesce_nvme(pdev);
+            }
+        } else if (pdev->class_code == PCI_CLASS_NETWORK) {
+            /* No common halt, the OS driver resets it anyway */
+            name = "NIC";
+        }
+
+        /* Bridges, display and chipset functions keep bus mastering */
+        if (name == NULL) {
+            continue;
+        }
+
+        uint16_t command = pci_dev_read16(pdev, PCI_COMMAND_OFFSET);
+        if (command & PCI_COMMAND_BUS_MASTER) {
+            pci_dev_write16(pdev, PCI_COMMAND_OFFSET, command & ~PCI_COMMAND_BUS_MASTER);
+        }
+
+        printf_verbose("Quiesce: %s %04x:%02x:%02x.%x %s%s\n", name,
+                       pdev->seg, pdev->bus, pdev->dev, pdev->func,
+                       ok ? "stopped" : "did not stop",
+                       command & PCI_COMMAND_BUS_MASTER ? ", bus master off" : "");
+        stopped++;
+    }
+
+    printf_verbose("Quiesce: %u controllers\n", stopped);
+}
@@ -0,0 +1,10 @@
+#ifndef QUIESCE_H
+#define QUIESCE_H
+
+/*
+ * After ExitBootServices: take the USB controllers away from SMM, halt
+ * the controllers UEFI drivers left running and stop their DMA.
+ */
+void quiesce_devices(void);
+
+#endif
@@ -0,0 +1,67 @@
+#include <efi.h>
+#include "csmwrap.h"
+#include "io.h"
+#include "timestamp.h"
+
+static struct timestamp_table *ts_table;
+
+void timestamp_init(void)
+{
+    uint64_t base = rdtsc();
+    EFI_PHYSICAL_ADDRESS addr = 0xffffffff;
+
+    /* Payloads read it after we are gone, keep it reserved and below 4G */
+    if (gBS->AllocatePages(AllocateMaxAddress, EfiReservedMemoryType, 1, &addr) != EFI_SUCCESS) {
+        printf("Unable to alloc timestamp table\n");
+        return;
+    }
+
+    ts_table = (struct timestamp_table *)(uintptr_t)addr;
+    memset(ts_table, 0, EFI_PAGE_SIZE);
+    ts_table->base_time = base;
+    ts_table->max_entries = (EFI_PAGE_SIZE - sizeof(struct timestamp_table)) / sizeof(struct timestamp_entry);
+
+    ts_table->entries[0].entry_id = TS_CSMWRAP_ENTRY;
+    ts_table->entries[0].entry_stamp = 0;
+    ts_table->num_entries = 1;
+}
+
+/* The TSC is calibrated after the first stamps are taken */
+void timestamp_set_tick_freq(uint64_t hz)
+{
+    if (ts_table != NULL) {
+        ts_table->tick_freq_mhz = hz / 1000000;
+    }
+}
+
+void timestamp_add_now(enum timestamp_id id)
+{
+    uint64_t now = rdtsc();
+    struct timestamp_entry *entry;
+
+    if (ts_table == NULL || ts_table->num_entries >= ts_table->max_entries) {
+        return;
+    }
+
+    entry = &ts_table->entries[ts_table->num_entries++];
+    entry->entry_id = id;
+    entry->entry_stamp = now - ts_table->base_time;
+}
+
+struct timestamp_table *timestamp_get_table(void)
+{
+    return ts_table;
+}
+
+/* One line per entry for tools scraping the log, see "make bench" */
+void timestamp_dump(void)
+{
+    if (ts_table == NULL || ts_table->tick_freq_mhz == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < ts_table->num_entries; i++) {
+        printf_verbose("Timestamp %u: %llu us\n", ts_table->entries[i].entry_id,
+                       (unsigned long long)(ts_table->entries[i].entry_stamp / ts_table->tick_freq_mhz));
+    }
+}
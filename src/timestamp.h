@@ -0,0 +1,42 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stdint.h>
+#include <edk2/Coreboot.h>
+
+/*
+ * Boot phase IDs recorded into the coreboot timestamp table.
+ * coreboot and its payloads own the IDs below 3000, keep ours out of the way.
+ */
+enum timestamp_id {
+    TS_CSMWRAP_ENTRY = 3000,
+    TS_UNLOCK_START,
+    TS_UNLOCK_END,
+    TS_WORKAROUNDS_START,
+    TS_WORKAROUNDS_END,
+    TS_ACPI_INIT_START,
+    TS_ACPI_INIT_END,
+    TS_VIDEO_INIT_START,
+    TS_VIDEO_INIT_END,
+    TS_EXIT_BOOT_SERVICES_START,
+    TS_EXIT_BOOT_SERVICES_END,
+    TS_E820_START,
+    TS_E820_END,
+    TS_ROM_COPY_START,
+    TS_ROM_COPY_END,
+    TS_LEGACY16_INIT_START,
+    TS_LEGACY16_INIT_END,
+    TS_LEGACY16_OPROM_START,
+    TS_LEGACY16_OPROM_END,
+    TS_LEGACY16_PREPARE_START,
+    TS_LEGACY16_PREPARE_END,
+    TS_LEGACY16_BOOT,
+};
+
+void timestamp_init(void);
+void timestamp_set_tick_freq(uint64_t hz);
+void timestamp_add_now(enum timestamp_id id);
+struct timestamp_table *timestamp_get_table(void);
+void timestamp_dump(void);
+
+#endif
@@ -8,8 +8,11 @@
 #include <stdbool.h>
 #include <efi.h>
 #include "csmwrap.h"
+#include "config.h"
 #include "edk2/LegacyRegion2.h"
 #include "io.h"
+#include "mtrr.h"
+#include "pci.h"
 
 static EFI_GUID gEfiLegacyRegion2ProtocolGuid = EFI_LEGACY_REGION2_PROTOCOL_GUID;
 
@@ -21,6 +24,15 @@ static EFI_GUID gEfiLegacyRegion2ProtocolGuid = EFI_LEGACY_REGION2_PROTOCOL_GUID
 #define PAM_LOCK_BIT   0x01    /* Bit indicating PAM registers are locked */
 #define PAM_LOCK_REG   0x80    /* Register containing PAM lock bit on newer Intel chipsets */
 #define PAM_ENABLE     0x33    /* Value to enable read/write (0x30 for read, 0x03 for write) */
+#define PAM_WRITE_ENABLE_LO 0x02  /* Write enable of the lower 16 KiB */
+#define PAM_WRITE_ENABLE_HI 0x20  /* Write enable of the upper 16 KiB, or all of PAM0 */
+#define PAM_SEGMENT_SIZE 0x4000
+#define PAM_FSEG_BASE  0xF0000
+
+/* PAM register blocks, indexed by bios_unlock_method */
+#define PIIX4_PAM0     0x59
+#define Q35_PAM0       0x90
+#define SKYLAKE_PAM0   0x80
 
 
 /*
@@ -51,24 +63,185 @@ static EFI_GUID gEfiLegacyRegion2ProtocolGuid = EFI_LEGACY_REGION2_PROTOCOL_GUID
 #define AMD_MTRR_FIX4K_WT_DRAM                  0x1C1C1C1C1C1C1C1Cull
 #define AMD_MTRR_FIX4K_UC_DRAM                  0x1818181818181818ull
 
-#define MSR_SYS_CFG                         0xC0010010ul
-#define SYS_CFG_MTRR_FIX_DRAM_EN            (1 << 18) ///< Core::X86::Msr::SYS_CFG::MtrrFixDramEn.
-                                                       ///< MTRR fixed RdDram and WrDram attributes enable.
-#define SYS_CFG_MTRR_FIX_DRAM_MOD_EN        (1 << 19) ///< Core::X86::Msr::SYS_CFG::MtrrFixDramModEn.
-                                                       ///< MTRR fixed RdDram and WrDram modification enable.
-#define SYS_CFG_MTRR_VAR_DRAM_EN            (1 << 20) ///< Core::X86::Msr::SYS_CFG::MtrrVarDramEn.
-                                                       ///< MTRR variable DRAM enable.
-#define SYS_CFG_MTRR_TOM2_EN                (1 << 21) ///< Core::X86::Msr::SYS_CFG::MtrrTom2En. MTRR
-                                                       ///< top of memory 2 enable.
-#define SYS_CFG_TOM2_FORCE_MEM_TYPE_WB      (1 << 22) ///< Core::X86::Msr::SYS_CFG::Tom2ForceMemTypeWB.
-                                                       ///< top of memory 2 memory type write back.
-
 /* Intel PCI Vendor ID */
 #define INTEL_VENDOR_ID 0x8086
 
 /* AMD Vendor ID */
 #define AMD_VENDOR_ID   0x1022
 
+/*
+ * The BIOS region is tracked in 16KiB segments, the finest granularity
+ * PAM and the Legacy Region protocol work at. Each segment is probed with
+ * its first and last dword instead of a full pass over the region.
+ * The romprobe=full option tests every dword, which is useful to diagnose
+ * chipsets with odd decode granularity.
+ */
+#define BIOS_SEGMENT_SIZE   0x4000
+#define BIOS_SEGMENT_COUNT  ((BIOSROM_END - BIOSROM_START) / BIOS_SEGMENT_SIZE)
+
+enum bios_segment_state {
+    BIOS_SEGMENT_UNKNOWN = 0,
+    BIOS_SEGMENT_RO,
+    BIOS_SEGMENT_RW,
+};
+
+static uint8_t bios_segment_state[BIOS_SEGMENT_COUNT];
+
+/* How unlock_bios_region() got the region writable, lock_bios_region() undoes it */
+enum bios_unlock_method {
+    BIOS_UNLOCK_NONE = 0,       /* Already writable, or the unlock failed */
+    BIOS_UNLOCK_PROTOCOL,
+    BIOS_UNLOCK_PIIX4,
+    BIOS_UNLOCK_Q35,
+    BIOS_UNLOCK_SKYLAKE,
+    BIOS_UNLOCK_AMD_MTRR,
+};
+
+static enum bios_unlock_method unlock_method;
+/* Set once the fixed MTRRs hold the WP layout lock_bios_region() relies on */
+static bool images_protected;
+
+static bool test_dword_rw(uint32_t *ptr)
+{
+    clflush(ptr);
+    uint32_t val = readl(ptr);
+
+    writel(ptr, ~val);
+    clflush(ptr);
+
+    bool ok = readl(ptr) == ~val;
+
+    writel(ptr, val);
+    return ok;
+}
+
+static bool test_segment_rw(uintptr_t base)
+{
+    uint32_t *start = (uint32_t *)base;
+    uint32_t *end = (uint32_t *)(base + BIOS_SEGMENT_SIZE);
+
+    if (gConfig.rom_probe_full) {
+        for (uint32_t *ptr = start; ptr < end; ptr++) {
+            if (!test_dword_rw(ptr)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    return test_dword_rw(start) && test_dword_rw(end - 1);
+}
+
+/**
+ * Forget the known state of segments overlapping [start, end) so the next
+ * test_bios_region_rw() probes them again. Called after reprogramming decode.
+ */
+static void bios_region_invalidate(uintptr_t start, uintptr_t end)
+{
+    for (size_t i = 0; i < BIOS_SEGMENT_COUNT; i++) {
+        uintptr_t base = BIOSROM_START + i * BIOS_SEGMENT_SIZE;
+
+        if (base < end && base + BIOS_SEGMENT_SIZE > start) {
+            bios_segment_state[i] = BIOS_SEGMENT_UNKNOWN;
+        }
+    }
+}
+
+/**
+ * Probe every segment not already known to be writable
+ *
+ * @return true if the whole BIOS region is read/write
+ */
+static bool test_bios_region_rw(void)
+{
+    bool ok = true;
+
+    for (size_t i = 0; i < BIOS_SEGMENT_COUNT; i++) {
+        if (bios_segment_state[i] == BIOS_SEGMENT_RW) {
+            continue;
+        }
+
+        if (test_segment_rw(BIOSROM_START + i * BIOS_SEGMENT_SIZE)) {
+            bios_segment_state[i] = BIOS_SEGMENT_RW;
+        } else {
+            bios_segment_state[i] = BIOS_SEGMENT_RO;
+            ok = false;
+        }
+    }
+
+    /* Report read-only segments as coalesced ranges */
+    for (size_t i = 0; i < BIOS_SEGMENT_COUNT; i++) {
+        if (bios_segment_state[i] != BIOS_SEGMENT_RO) {
+            continue;
+        }
+
+        size_t j = i;
+        while (j + 1 < BIOS_SEGMENT_COUNT && bios_segment_state[j + 1] == BIOS_SEGMENT_RO) {
+            j++;
+        }
+        printf("Unable to write to BIOS region 0x%x-0x%x\n",
+               (uint32_t)(BIOSROM_START + i * BIOS_SEGMENT_SIZE),
+               (uint32_t)(BIOSROM_START + (j + 1) * BIOS_SEGMENT_SIZE - 1));
+        i = j;
+    }
+
+    return ok;
+}
+
+/**
+ * Span of the segments overlapping [start, end) that are not known to be
+ * writable. Memory outside the tracked region always needs unlocking.
+ *
+ * @return true if there is anything to unlock, with [*lo, *hi) set to it
+ */
+static bool bios_region_locked_span(uintptr_t start, uintptr_t end, uintptr_t *lo, uintptr_t *hi)
+{
+    bool found = false;
+
+    if (start < BIOSROM_START) {
+        *lo = start;
+        *hi = end < BIOSROM_START ? end : BIOSROM_START;
+        found = true;
+    }
+
+    for (size_t i = 0; i < BIOS_SEGMENT_COUNT; i++) {
+        uintptr_t base = BIOSROM_START + i * BIOS_SEGMENT_SIZE;
+
+        if (base >= end || base + BIOS_SEGMENT_SIZE <= start ||
+            bios_segment_state[i] == BIOS_SEGMENT_RW) {
+            continue;
+        }
+        if (!found) {
+            *lo = base;
+        }
+        *hi = base + BIOS_SEGMENT_SIZE;
+        found = true;
+    }
+
+    return found;
+}
+
+/**
+ * Enable read+write in every PAM register of the block at pam0 that
+ * decodes a segment not yet known to be writable, and forget the state
+ * of just those segments. PAM0 is the F segment, PAM1-PAM6 cover
+ * 0xC0000-0xEFFFF in 32 KiB steps.
+ */
+static void unlock_pam(uint8_t pam0, uint8_t pam0_value)
+{
+    for (uint8_t i = 0; i <= 6; i++) {
+        uintptr_t start = i == 0 ? PAM_FSEG_BASE : VGABIOS_START + (i - 1) * 2 * PAM_SEGMENT_SIZE;
+        uintptr_t end = i == 0 ? BIOSROM_END : start + 2 * PAM_SEGMENT_SIZE;
+        uintptr_t lo, hi;
+
+        if (!bios_region_locked_span(start, end, &lo, &hi)) {
+            continue;
+        }
+        pci_write8(0, 0, 0, 0, pam0 + i, i == 0 ? pam0_value : PAM_ENABLE);
+        bios_region_invalidate(start, end);
+    }
+}
+
 /**
  * Unlock BIOS memory region using the Legacy Region 2 Protocol
  *
@@ -88,45 +261,49 @@ EFI_STATUS unlock_legacy_region_protocol(void)
     );
 
     if (EFI_ERROR(status)) {
-        printf("Legacy Region 2 Protocol not found (status: %lx)\n", status);
+        printf("Legacy Region 2 Protocol not found (status: %lx)\n", (unsigned long)status);
         return status;
     }
 
-    /*
-    * Unlock the entire legacy BIOS region (0xC0000 to 0xFFFFF)
-    * Each region covers 64KB
-    */
+    /* Only the span that is still read-only, firmware may have opened the rest */
+    uintptr_t lo, hi;
+    if (!bios_region_locked_span(VGABIOS_START, BIOSROM_END, &lo, &hi)) {
+        return EFI_SUCCESS;
+    }
 
     /* First enable memory reads in the region */
     bool on = TRUE;
     status = legacy_region->Decode(
         legacy_region,
-        0xC0000,         /* Start address */
-        0x40000,         /* Length (256KB) */
+        lo,              /* Start address */
+        hi - lo,         /* Length */
         &granularity,
         &on
     );
     
     if (EFI_ERROR(status)) {
-        printf("Failed to enable memory reads in legacy region (status: %lx)\n", status);
+        printf("Failed to enable memory reads in legacy region (status: %lx)\n", (unsigned long)status);
         return status;
     }
 
     /* Then enable memory writes in the region */
     status = legacy_region->UnLock(
         legacy_region,
-        0xC0000,         /* Start address */
-        0x40000,         /* Length (256KB) */
+        lo,              /* Start address */
+        hi - lo,         /* Length */
         &granularity
     );
 
     if (EFI_ERROR(status)) {
-        printf("Failed to enable memory writes in legacy region (status: %lx)\n", status);
+        printf("Failed to enable memory writes in legacy region (status: %lx)\n", (unsigned long)status);
         return status;
     }
     
-    printf("Successfully unlocked legacy region 0xC0000-0xFFFFF using UEFI protocol\n");
-    printf("Granularity: 0x%x bytes\n", granularity);
+    bios_region_invalidate(lo, hi);
+
+    printf("Successfully unlocked legacy region 0x%x-0x%x using UEFI protocol\n",
+           (uint32_t)lo, (uint32_t)(hi - 1));
+    printf_verbose("Granularity: 0x%x bytes\n", granularity);
 
     return EFI_SUCCESS;
 }
@@ -140,14 +317,7 @@ int unlock_piix4_pam(void)
 {
     printf("Unlocking BIOS region with PIIX4 PAM\n");
 
-    /* Enable read+write for PAM0-PAM6 (0x59-0x96) */
-    pciConfigWriteByte(0, 0, 0, 0x59, PAM_ENABLE);  /* PAM0 (0xF0000-0xFFFFF) */
-    pciConfigWriteByte(0, 0, 0, 0x5a, PAM_ENABLE);  /* PAM1 (0xC0000-0xC3FFF) */
-    pciConfigWriteByte(0, 0, 0, 0x5b, PAM_ENABLE);  /* PAM2 (0xC4000-0xC7FFF) */
-    pciConfigWriteByte(0, 0, 0, 0x5c, PAM_ENABLE);  /* PAM3 (0xC8000-0xCBFFF) */
-    pciConfigWriteByte(0, 0, 0, 0x5d, PAM_ENABLE);  /* PAM4 (0xCC000-0xCFFFF) */
-    pciConfigWriteByte(0, 0, 0, 0x5e, PAM_ENABLE);  /* PAM5 (0xD0000-0xD3FFF) */
-    pciConfigWriteByte(0, 0, 0, 0x5f, PAM_ENABLE);  /* PAM6 (0xD4000-0xD7FFF) */
+    unlock_pam(PIIX4_PAM0, PAM_ENABLE);
 
     return 0;
 }
@@ -161,14 +331,7 @@ int unlock_q35_pam(void)
 {
     printf("Unlocking BIOS region with Q35 PAM\n");
 
-    /* Enable read+write for PAM0-PAM6 (0x90-0x96) */
-    pciConfigWriteByte(0, 0, 0, 0x90, PAM_ENABLE);  /* PAM0 (0xF0000-0xFFFFF) */
-    pciConfigWriteByte(0, 0, 0, 0x91, PAM_ENABLE);  /* PAM1 (0xC0000-0xC3FFF) */
-    pciConfigWriteByte(0, 0, 0, 0x92, PAM_ENABLE);  /* PAM2 (0xC4000-0xC7FFF) */
-    pciConfigWriteByte(0, 0, 0, 0x93, PAM_ENABLE);  /* PAM3 (0xC8000-0xCBFFF) */
-    pciConfigWriteByte(0, 0, 0, 0x94, PAM_ENABLE);  /* PAM4 (0xCC000-0xCFFFF) */
-    pciConfigWriteByte(0, 0, 0, 0x95, PAM_ENABLE);  /* PAM5 (0xD0000-0xD3FFF) */
-    pciConfigWriteByte(0, 0, 0, 0x96, PAM_ENABLE);  /* PAM6 (0xD4000-0xD7FFF) */
+    unlock_pam(Q35_PAM0, PAM_ENABLE);
 
     return 0;
 }
@@ -183,19 +346,13 @@ int unlock_skylake_pam(void)
     printf("Unlocking BIOS region with Intel Skylake+ Generic PAM\n");
 
     /* Check if PAM is locked */
-    if (pciConfigReadByte(0, 0, 0, PAM_LOCK_REG) & PAM_LOCK_BIT) {
+    if (pci_read8(0, 0, 0, 0, PAM_LOCK_REG) & PAM_LOCK_BIT) {
         printf("PAM is locked on your platform\n");
         return -1;
     }
 
-    /* Enable read+write for PAM0-PAM6 (0x80-0x86) */
-    pciConfigWriteByte(0, 0, 0, 0x80, 0x30);        /* PAM0 special case (typically only enables read) */
-    pciConfigWriteByte(0, 0, 0, 0x81, PAM_ENABLE);  /* PAM1 */
-    pciConfigWriteByte(0, 0, 0, 0x82, PAM_ENABLE);  /* PAM2 */
-    pciConfigWriteByte(0, 0, 0, 0x83, PAM_ENABLE);  /* PAM3 */
-    pciConfigWriteByte(0, 0, 0, 0x84, PAM_ENABLE);  /* PAM4 */
-    pciConfigWriteByte(0, 0, 0, 0x85, PAM_ENABLE);  /* PAM5 */
-    pciConfigWriteByte(0, 0, 0, 0x86, PAM_ENABLE);  /* PAM6 */
+    /* PAM0 special case (typically only enables read) */
+    unlock_pam(SKYLAKE_PAM0, 0x30);
 
     return 0;
 }
@@ -208,9 +365,11 @@ int unlock_skylake_pam(void)
 int unlock_amd_mtrr(void)
 {
     uint64_t val;
+    struct mtrr_update update;
     printf("Unlocking BIOS region with AMD MTRR\n");
 
-    /* TODO: Investigate SMP impact */
+    /* APs get the same layout from mp_sync_mtrrs() */
+    mtrr_update_begin(&update);
     val = rdmsr(MSR_SYS_CFG);
     val |= SYS_CFG_MTRR_FIX_DRAM_MOD_EN;
     wrmsr(MSR_SYS_CFG, val);
@@ -233,6 +392,9 @@ int unlock_amd_mtrr(void)
     val &= ~SYS_CFG_MTRR_FIX_DRAM_MOD_EN;
     val |= SYS_CFG_MTRR_FIX_DRAM_EN;
     wrmsr(MSR_SYS_CFG, val);
+    mtrr_update_end(&update);
+    /* The 4K fixed MTRRs above cover the whole region */
+    bios_region_invalidate(VGABIOS_START, BIOSROM_END);
 
     return 0;
 }
@@ -256,7 +418,7 @@ EFI_STATUS print_legacy_region_info(EFI_LEGACY_REGION2_PROTOCOL *legacy_region)
     );
     
     if (EFI_ERROR(status)) {
-        printf("Failed to get legacy region information (status: %lx)\n", status);
+        printf("Failed to get legacy region information (status: %lx)\n", (unsigned long)status);
         return status;
     }
 
@@ -299,30 +461,6 @@ EFI_STATUS print_legacy_region_info(EFI_LEGACY_REGION2_PROTOCOL *legacy_region)
     return EFI_SUCCESS;
 }
 
-static bool test_bios_region_rw(void) {
-    uint32_t *bios_region = (uint32_t *)BIOSROM_START;
-    uint32_t *bios_region_end = (uint32_t *)BIOSROM_END;
-    uint32_t *ptr = bios_region;
-
-    while (ptr < bios_region_end) {
-        clflush(ptr);
-        uint32_t val = readl(ptr);
-
-        writel(ptr, ~val);
-        clflush(ptr);
-
-        if (readl(ptr) != ~val) {
-            printf("Unable to write to BIOS region\n");
-            return false;
-        }
-
-        writel(ptr, val);
-        ptr++;
-    }
-
-    return true;
-}
-
 /**
  * Main function to unlock the BIOS region
  * Tries to use the UEFI protocol first, then falls back to chipset-specific methods
@@ -348,11 +486,14 @@ int unlock_bios_region(void)
 
     if (!EFI_ERROR(status)) {
         /* If we have the protocol, print region information for debugging */
-        print_legacy_region_info(legacy_region);
+        if (gConfig.log_level >= LOG_VERBOSE) {
+            print_legacy_region_info(legacy_region);
+        }
         
         /* Try to unlock using the protocol */
         status = unlock_legacy_region_protocol();
         if (!EFI_ERROR(status) && test_bios_region_rw()) {
+            unlock_method = BIOS_UNLOCK_PROTOCOL;
             return 0;  /* Success */
         }
 
@@ -363,10 +504,10 @@ int unlock_bios_region(void)
     }
 
     /* Check for known chipsets and use appropriate method */
-    uint32_t host_bridge_id = pciConfigReadDWord(0, 0, 0, 0x0);
-    printf("Host Bridge ID: 0x%08x\n", host_bridge_id);
-    uint16_t vendor_id = (host_bridge_id & 0xFFFF);
-    uint16_t device_id = (host_bridge_id >> 16) & 0xFFFF;
+    struct pci_device *host_bridge = pci_find_device(0, 0, 0, 0);
+    uint16_t vendor_id = host_bridge ? host_bridge->vendor_id : 0xFFFF;
+    uint16_t device_id = host_bridge ? host_bridge->device_id : 0xFFFF;
+    printf_verbose("Host Bridge ID: 0x%04x%04x\n", device_id, vendor_id);
 
     switch (vendor_id) {
         case INTEL_VENDOR_ID:
@@ -377,19 +518,23 @@ int unlock_bios_region(void)
                 case 0x7194: /* 440MX */
                 case 0x7180: /* 440LX/EX */
                     status = unlock_piix4_pam();
+                    unlock_method = BIOS_UNLOCK_PIIX4;
                     break;
                 case 0x29C0: /* Q35 (QEMU) */
                 case 0x29E0: /* X38/X48 (VirtualBox) */
                     status = unlock_q35_pam();
+                    unlock_method = BIOS_UNLOCK_Q35;
                     break;
                 default:
                     status = unlock_skylake_pam();
+                    unlock_method = BIOS_UNLOCK_SKYLAKE;
                     break;
             }
             break;
         case AMD_VENDOR_ID:
             /* AMD chipsets */
             status = unlock_amd_mtrr();
+            unlock_method = BIOS_UNLOCK_AMD_MTRR;
             break;
         default:
             status = EFI_UNSUPPORTED;
@@ -397,5 +542,139 @@ int unlock_bios_region(void)
             break;
     }
 
-    return (status == 0 && test_bios_region_rw()) ? 0 : -1;
+    if (status == 0 && test_bios_region_rw()) {
+        return 0;
+    }
+
+    unlock_method = BIOS_UNLOCK_NONE;
+    return -1;
+}
+
+/**
+ * Make the unlocked BIOS region write-back cacheable for the ROM copy.
+ * Runs on the BSP before mp_sync_mtrrs() so the APs agree, and again after
+ * it to undo bios_region_protect_images() on the BSP alone.
+ *
+ * @return 0 on success, -1 if the fixed MTRRs are unavailable
+ */
+int bios_region_cache_for_copy(void)
+{
+    return mtrr_set_fixed(VGABIOS_START, BIOSROM_END,
+                          MTRR_TYPE_WB | MTRR_FIXED_AMD_RDDRAM | MTRR_FIXED_AMD_WRDRAM);
+}
+
+/* PAM block the unlock went through, 0 if the region can't be locked again */
+static uint8_t unlock_pam0(void)
+{
+    switch (unlock_method) {
+        case BIOS_UNLOCK_PIIX4:
+            return PIIX4_PAM0;
+        case BIOS_UNLOCK_Q35:
+            return Q35_PAM0;
+        case BIOS_UNLOCK_SKYLAKE:
+            return SKYLAKE_PAM0;
+        default:
+            /* The protocol can't be called after ExitBootServices, AMD has no PAM */
+            return 0;
+    }
+}
+
+static void align_range(uintptr_t *start, uintptr_t *end)
+{
+    *start &= ~(uintptr_t)(PAM_SEGMENT_SIZE - 1);
+    *end = (*end + PAM_SEGMENT_SIZE - 1) & ~(uintptr_t)(PAM_SEGMENT_SIZE - 1);
+}
+
+/* Make the VGA BIOS and CSM16 image ranges write-protect in this CPU's fixed MTRRs */
+static int set_images_wp(uintptr_t vgabios_end, uintptr_t csm_base)
+{
+    uintptr_t ranges[2][2] = {
+        { VGABIOS_START, vgabios_end },
+        { csm_base, BIOSROM_END },
+    };
+
+    for (int i = 0; i < 2; i++) {
+        uintptr_t start = ranges[i][0], end = ranges[i][1];
+
+        if (end <= start) {
+            continue;
+        }
+        align_range(&start, &end);
+        /* PAM will drop the writes, WP keeps the reads cached without caching writes */
+        if (mtrr_set_fixed(start, end, MTRR_TYPE_WP) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Put the final write-protect layout for lock_bios_region() in the fixed
+ * MTRRs of the BSP, for mp_sync_mtrrs() to hand to the APs, and the OS
+ * that later wakes them. The BSP itself goes back to write-back with
+ * bios_region_cache_for_copy() afterwards, so the ROM copy and the
+ * Legacy16 calls run cached; lock_bios_region() makes it match again.
+ *
+ * @return 0 on success, -1 if the region can't be locked later
+ */
+int bios_region_protect_images(uintptr_t vgabios_end, uintptr_t csm_base)
+{
+    if (unlock_pam0() == 0) {
+        return -1;
+    }
+
+    if (set_images_wp(vgabios_end, csm_base) != 0) {
+        return -1;
+    }
+    images_protected = true;
+    return 0;
+}
+
+/* Clear the write enable of every PAM half overlapping [start, end) */
+static void lock_pam(uint8_t pam0, uintptr_t start, uintptr_t end)
+{
+    align_range(&start, &end);
+
+    /* PAM1-PAM6 cover 0xC0000-0xEFFFF, two 16 KiB halves each */
+    for (uintptr_t base = VGABIOS_START; base < PAM_FSEG_BASE; base += PAM_SEGMENT_SIZE) {
+        if (base >= end || base + PAM_SEGMENT_SIZE <= start) {
+            continue;
+        }
+
+        uint8_t reg = pam0 + 1 + (base - VGABIOS_START) / (2 * PAM_SEGMENT_SIZE);
+        uint8_t we = ((base / PAM_SEGMENT_SIZE) & 1) ? PAM_WRITE_ENABLE_HI : PAM_WRITE_ENABLE_LO;
+        pci_write8(0, 0, 0, 0, reg, pci_read8(0, 0, 0, 0, reg) & ~we);
+    }
+
+    /* PAM0 covers all of 0xF0000-0xFFFFF in its high half */
+    if (end > PAM_FSEG_BASE) {
+        pci_write8(0, 0, 0, 0, pam0, pci_read8(0, 0, 0, 0, pam0) & ~PAM_WRITE_ENABLE_HI);
+    }
+
+    printf_verbose("BIOS region 0x%x-0x%x write-protected\n", (uint32_t)start, (uint32_t)(end - 1));
+}
+
+/**
+ * Write-protect the VGA BIOS and CSM16 images once Legacy16PrepareToBoot is
+ * done, like a real BIOS does. The space in between stays writable for UMBs.
+ * The APs got the WP layout from bios_region_protect_images() before
+ * ExitBootServices, the BSP switches to it here, then PAM drops the writes.
+ *
+ * @return 0 on success, -1 if the region stays writable
+ */
+int lock_bios_region(uintptr_t vgabios_end, uintptr_t csm_base)
+{
+    uint8_t pam0 = unlock_pam0();
+
+    /* Write-back lines over a PAM read-only range would hide the lock */
+    if (pam0 == 0 || !images_protected || set_images_wp(vgabios_end, csm_base) != 0) {
+        printf_verbose("BIOS region left writable\n");
+        return -1;
+    }
+
+    if (vgabios_end > VGABIOS_START) {
+        lock_pam(pam0, VGABIOS_START, vgabios_end);
+    }
+    lock_pam(pam0, csm_base, BIOSROM_END);
+    return 0;
 }
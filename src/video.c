@@ -2,12 +2,14 @@
 #include <video.h>
 #include <csmwrap.h>
 #include <io.h>
+#include <pci.h>
 
-// Generated by: xxd -i vgabios.bin >> vgabios.h
+// Generated by: lz4 -l vgabios.bin && xxd -i vgabios.bin.lz4 >> vgabios.h
 #include <bins/vgabios.h>
 
 void *vbios_loc = NULL;
 uintptr_t vbios_size;
+uintptr_t vbios_lz4_size;
 
 static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
 {
@@ -32,7 +34,7 @@ static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
                     &HandleBuffer
                     );
     if (EFI_ERROR(Status)) {
-        printf("Failed to locate GOP handles: %d\n", Status);
+        printf("Failed to locate GOP handles: %lx\n", (unsigned long)Status);
         return Status;
     }
 
@@ -68,7 +70,7 @@ static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
     // We are done with previous handle buffer atm
     gBS->FreePool(HandleBuffer);
     if (EFI_ERROR(Status)) {
-        printf("Failed to get Device Path protocol: %d\n", Status);
+        printf("Failed to get Device Path protocol: %lx\n", (unsigned long)Status);
         goto Out;
     }
 
@@ -79,7 +81,7 @@ static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
         );
 
     if (EFI_ERROR(Status)) {
-        printf("Failed to locate PCI I/O protocol: %d\n", Status);
+        printf("Failed to locate PCI I/O protocol: %lx\n", (unsigned long)Status);
         goto Out;
     }
 
@@ -106,28 +108,34 @@ static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
         priv->vga_pci_bus = (UINT8)Bus;
         priv->vga_pci_devfn = (UINT8)(Device << 3 | Function);
 
-        Status = PciIo->Pci.Read(
-                                PciIo,
-                                EfiPciIoWidthUint16,
-                                0, // Vendor ID offset
-                                1,
-                                &VendorId
-                                );
-
-        Status = PciIo->Pci.Read(
-                                PciIo,
-                                EfiPciIoWidthUint16,
-                                2, // Device ID offset
-                                1,
-                                &DeviceId
-                                );
-
-
-        printf("GOP PCI: %04x:%02x:%02x.%02x %04x:%04x\n",
-                    Seg, (UINT8)Bus, (UINT8)Device, (UINT8)Function,
+        struct pci_device *pdev = pci_find_device(Seg, Bus, Device, Function);
+        if (pdev != NULL) {
+            VendorId = pdev->vendor_id;
+            DeviceId = pdev->device_id;
+        } else {
+            Status = PciIo->Pci.Read(
+                                    PciIo,
+                                    EfiPciIoWidthUint16,
+                                    0, // Vendor ID offset
+                                    1,
+                                    &VendorId
+                                    );
+
+            Status = PciIo->Pci.Read(
+                                    PciIo,
+                                    EfiPciIoWidthUint16,
+                                    2, // Device ID offset
+                                    1,
+                                    &DeviceId
+                                    );
+        }
+
+
+        printf_verbose("GOP PCI: %04x:%02x:%02x.%02x %04x:%04x\n",
+                    (UINT32)Seg, (UINT8)Bus, (UINT8)Device, (UINT8)Function,
                     VendorId, DeviceId);
     } else {
-        printf("Failed to get PCI I/O protocol: %d\n", Status);
+        printf("Failed to get PCI I/O protocol: %lx\n", (unsigned long)Status);
     }
 Out:
   return Status;
@@ -238,7 +246,7 @@ GetPciLegacyRom (
           }
         }
       } else {
-        DEBUG ((DEBUG_ERROR, "GetPciLegacyRom - OpRom not match (%04x-%04x)\n", (UINTN)VendorId, (UINTN)DeviceId));
+        DEBUG ((DEBUG_ERROR, "GetPciLegacyRom - OpRom not match (%04x-%04x)\n", (uint32_t)VendorId, (uint32_t)DeviceId));
       }
     }
 
@@ -313,7 +321,7 @@ static EFI_STATUS csmwrap_pci_vgaarb(struct csmwrap_priv *priv)
                                0, &Supported);
 
     if (EFI_ERROR(Status)) {
-        printf("%s: Failed to get supported attributes: %d\n", __func__, Status);
+        printf("%s: Failed to get supported attributes: %lx\n", __func__, (unsigned long)Status);
         return Status;
     }
 
@@ -341,11 +349,11 @@ static EFI_STATUS csmwrap_pci_vgaarb(struct csmwrap_priv *priv)
     Status = PciIo->Attributes(PciIo, EfiPciIoAttributeOperationEnable,
                                Attributes, NULL);
     if (EFI_ERROR(Status)) {
-        printf("%s: Failed to set attributes: %d\n", __func__, Status);
+        printf("%s: Failed to set attributes: %lx\n", __func__, (unsigned long)Status);
         return Status;
     }
 
-    printf("%s: Success! Attributes: %llx\n", __func__, Attributes);
+    printf_verbose("%s: Success! Attributes: %llx\n", __func__, (unsigned long long)Attributes);
 
     return 0;
 }
@@ -359,7 +367,7 @@ static EFI_STATUS csmwrap_video_oprom_init(struct csmwrap_priv *priv)
     VOID  *LocalRomImage;
 
     if (!PciIo || !PciIo->RomImage || !PciIo->RomSize) {
-        DEBUG((DEBUG_ERROR, No PCI I/O protocol or RomImage function\n));
+        DEBUG((DEBUG_ERROR, "No PCI I/O protocol or RomImage function\n"));
         return EFI_UNSUPPORTED;
     }
 
@@ -386,7 +394,7 @@ static EFI_STATUS csmwrap_video_oprom_init(struct csmwrap_priv *priv)
              );
 
     if (EFI_ERROR(Status)) {
-        DEBUG((DEBUG_ERROR, "GetPciLegacyRom failed: %r\n", Status));
+        DEBUG((DEBUG_ERROR, "GetPciLegacyRom failed: %lx\n", (unsigned long)Status));
         return Status;
     }
 
@@ -424,7 +432,7 @@ static EFI_STATUS csmwrap_video_seavgabios_init(struct csmwrap_priv *priv)
     }
 
     printf("%c %3d. %4d x%4d (pitch %4d fmt %d r:%06x g:%06x b:%06x)\n",
-        '*', currentMode,
+        '*', (int)currentMode,
         info->HorizontalResolution, info->VerticalResolution, info->PixelsPerScanLine, info->PixelFormat,
         info->PixelFormat==PixelRedGreenBlueReserved8BitPerColor?0xff:(
         info->PixelFormat==PixelBlueGreenRedReserved8BitPerColor?0xff0000:(
@@ -438,7 +446,7 @@ static EFI_STATUS csmwrap_video_seavgabios_init(struct csmwrap_priv *priv)
 
     fb_addr = (unsigned long)gop->Mode->FrameBufferBase;
 
-    printf("EFI Framebuffer: %lx\n", fb_addr);
+    printf_verbose("EFI Framebuffer: %lx\n", fb_addr);
 
     if (!fb_addr) {
         printf("Framebuffer invalid.\n");
@@ -498,8 +506,9 @@ static EFI_STATUS csmwrap_video_seavgabios_init(struct csmwrap_priv *priv)
             return EFI_UNSUPPORTED;
     }
 
-    vbios_loc = vgabios_bin;
-    vbios_size = sizeof(vgabios_bin);
+    vbios_loc = vgabios_bin_lz4;
+    vbios_size = VGABIOS_BIN_SIZE;
+    vbios_lz4_size = sizeof(vgabios_bin_lz4);
 
     priv->video_type = CSMWRAP_VIDEO_SEAVGABIOS;
 
@@ -527,8 +536,9 @@ static EFI_STATUS csmwrap_video_fallback(struct csmwrap_priv *priv)
     cb_fb->reserved_mask_pos = 24;
     cb_fb->reserved_mask_size = 8;
 
-    vbios_loc = vgabios_bin;
-    vbios_size = sizeof(vgabios_bin);
+    vbios_loc = vgabios_bin_lz4;
+    vbios_size = VGABIOS_BIN_SIZE;
+    vbios_lz4_size = sizeof(vgabios_bin_lz4);
 
     priv->video_type = CSMWRAP_VIDEO_FALLBACK;
 
@@ -563,7 +573,7 @@ EFI_STATUS csmwrap_video_prepare_exitbs(struct csmwrap_priv *priv)
                         );
 
         if (EFI_ERROR(Status)) {
-            DEBUG((DEBUG_ERROR, "DisconnectController failed: %d\n", Status));
+            DEBUG((DEBUG_ERROR, "DisconnectController failed: %lx\n", (unsigned long)Status));
             return Status;
         }
     }
@@ -7,6 +7,8 @@
 
 extern void *vbios_loc;
 extern uintptr_t vbios_size;
+/* Non-zero if vbios_loc holds LZ4 data of this size, vbios_size is then the decompressed size */
+extern uintptr_t vbios_lz4_size;
 
 EFI_STATUS csmwrap_video_init(struct csmwrap_priv *priv);
 EFI_STATUS csmwrap_video_prepare_exitbs(struct csmwrap_priv *priv);
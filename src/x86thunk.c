@@ -445,7 +445,7 @@ uintptr_t LegacyBiosInitializeThunkAndTable(uintptr_t MemoryAddress, size_t data
 
   memset(mThunkContext.RealModeBuffer, 0, mThunkContext.RealModeBufferSize);
 
-  printf("RealmodeBuffer %lx\n", (uintptr_t)mThunkContext.RealModeBuffer);
+  printf_verbose("RealmodeBuffer %lx\n", (unsigned long)mThunkContext.RealModeBuffer);
 
   AsmPrepareThunk16 (&mThunkContext);
 
@@ -0,0 +1,23 @@
+# Boot phase times from the "Timestamp <id>: <us> us" lines CSMWrap prints
+# right before Legacy16Boot, see timestamp_dump() and "make bench".
+# IDs are the enum timestamp_id values in src/timestamp.h.
+
+/^Timestamp [0-9]+: [0-9]+ us/ {
+    id = $2 + 0
+    us = $3 + 0
+    if (prev_id != "") {
+        printf "  %d -> %d: %d us\n", prev_id, id, us - prev_us
+    }
+    prev_id = id
+    prev_us = us
+    total = us
+    found = 1
+}
+
+END {
+    if (!found) {
+        print "No timestamps in the log, did CSMWrap reach Legacy16Boot?" > "/dev/stderr"
+        exit 1
+    }
+    printf "Entry to Legacy16Boot: %d us\n", total
+}
@@ -0,0 +1,104 @@
+/*
+ * Host stand-in for nyu-efi's efi.h, just enough for the modules the host
+ * tests build. Firmware interfaces are left incomplete, the code under
+ * test never calls into them.
+ */
+
+#ifndef HOST_EFI_H
+#define HOST_EFI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t UINT8;
+typedef int8_t INT8;
+typedef uint16_t UINT16;
+typedef int16_t INT16;
+typedef uint32_t UINT32;
+typedef int32_t INT32;
+typedef uint64_t UINT64;
+typedef int64_t INT64;
+typedef uintptr_t UINTN;
+typedef intptr_t INTN;
+typedef bool BOOLEAN;
+typedef void VOID;
+typedef char CHAR8;
+typedef uint16_t CHAR16;
+
+typedef UINTN EFI_STATUS;
+typedef void *EFI_HANDLE;
+typedef void *EFI_EVENT;
+typedef UINTN EFI_TPL;
+typedef UINT64 EFI_PHYSICAL_ADDRESS;
+typedef UINT64 EFI_VIRTUAL_ADDRESS;
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define CONST const
+#define EFIAPI __attribute__((ms_abi))
+
+#define TRUE 1
+#define FALSE 0
+
+#define EFI_SIGNATURE_16(A, B) ((A) | ((B) << 8))
+#define EFI_SIGNATURE_32(A, B, C, D) (EFI_SIGNATURE_16(A, B) | (EFI_SIGNATURE_16(C, D) << 16))
+#define EFI_SIGNATURE_64(A, B, C, D, E, F, G, H) \
+    (EFI_SIGNATURE_32(A, B, C, D) | ((UINT64)EFI_SIGNATURE_32(E, F, G, H) << 32))
+
+#define EFIERR(a) ((UINTN)1 << (sizeof(UINTN) * 8 - 1) | (a))
+#define EFI_ERROR(a) (((INTN)(a)) < 0)
+#define EFI_SUCCESS 0
+#define EFI_INVALID_PARAMETER EFIERR(2)
+#define EFI_UNSUPPORTED EFIERR(3)
+#define EFI_DEVICE_ERROR EFIERR(7)
+#define EFI_ACCESS_DENIED EFIERR(15)
+
+#define EFI_PAGE_SIZE 4096
+#define EFI_PAGES_TO_SIZE(a) ((a) << 12)
+#define EFI_MEMORY_RP 0x2000
+
+typedef struct {
+    UINT32 Data1;
+    UINT16 Data2;
+    UINT16 Data3;
+    UINT8 Data4[8];
+} EFI_GUID;
+
+typedef enum {
+    EfiReservedMemoryType,
+    EfiLoaderCode,
+    EfiLoaderData,
+    EfiBootServicesCode,
+    EfiBootServicesData,
+    EfiRuntimeServicesCode,
+    EfiRuntimeServicesData,
+    EfiConventionalMemory,
+    EfiUnusableMemory,
+    EfiACPIReclaimMemory,
+    EfiACPIMemoryNVS,
+    EfiMemoryMappedIO,
+    EfiMemoryMappedIOPortSpace,
+    EfiPalCode,
+    EfiPersistentMemory,
+    EfiMaxMemoryType
+} EFI_MEMORY_TYPE;
+
+typedef struct {
+    UINT32 Type;
+    EFI_PHYSICAL_ADDRESS PhysicalStart;
+    EFI_VIRTUAL_ADDRESS VirtualStart;
+    UINT64 NumberOfPages;
+    UINT64 Attribute;
+} EFI_MEMORY_DESCRIPTOR;
+
+typedef struct EFI_SYSTEM_TABLE EFI_SYSTEM_TABLE;
+typedef struct EFI_BOOT_SERVICES EFI_BOOT_SERVICES;
+typedef struct EFI_RUNTIME_SERVICES EFI_RUNTIME_SERVICES;
+typedef struct _EFI_GRAPHICS_OUTPUT_PROTOCOL EFI_GRAPHICS_OUTPUT_PROTOCOL;
+typedef struct _EFI_PCI_IO_PROTOCOL EFI_PCI_IO_PROTOCOL;
+typedef struct _EFI_DEVICE_PATH_PROTOCOL EFI_DEVICE_PATH_PROTOCOL;
+typedef struct BBS_BBS_DEVICE_PATH BBS_BBS_DEVICE_PATH;
+
+#endif
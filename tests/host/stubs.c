@@ -0,0 +1,56 @@
+/*
+ * What the modules under test expect from the rest of CSMWrap. Their
+ * printf output is dropped unless CSMWRAP_TEST_VERBOSE is set, the
+ * tests themselves report through test_log().
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <efi.h>
+#include <config.h>
+#include "test.h"
+
+EFI_SYSTEM_TABLE *gST;
+EFI_BOOT_SERVICES *gBS;
+EFI_RUNTIME_SERVICES *gRT;
+
+struct csmwrap_config gConfig = {
+    .log_level = LOG_INFO,
+};
+
+int test_failures;
+
+int printf(const char *restrict fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    if (getenv("CSMWRAP_TEST_VERBOSE") == NULL) {
+        return 0;
+    }
+
+    va_start(ap, fmt);
+    ret = vfprintf(stdout, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+void test_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stdout, fmt, ap);
+    va_end(ap);
+}
+
+int test_report(const char *name)
+{
+    if (test_failures != 0) {
+        test_log("%s: %d checks FAILED\n", name, test_failures);
+        return 1;
+    }
+
+    test_log("%s: OK\n", name);
+    return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Minimal harness for the host tests: checks that keep going on failure,
+ * a deterministic PRNG so failures reproduce, and a wall clock for the
+ * timing loops.
+ */
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+extern int test_failures;
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #cond);                         \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+/* xorshift64, never seed it with 0 */
+static inline uint64_t test_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static inline double test_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Results and timings, printf belongs to the code under test */
+void test_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+/* Print the verdict, returns the exit code for main() */
+int test_report(const char *name);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * CbCheckSum16() against a plain RFC 1071 checksum, and the property
+ * coreboot readers rely on: a table with its checksum filled in sums to 0.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#include "coreboot.c"
+
+/* build_coreboot_table() pulls these in, it is not called here */
+struct timestamp_table *timestamp_get_table(void) { return NULL; }
+uint64_t clock_tsc_hz(void) { return 0; }
+struct cbmem_console *console_get_cbmem(void) { return NULL; }
+
+#define MAX_LENGTH  4096
+#define BENCH_SIZE  (64 * 1024)
+#define BENCH_LOOPS 2000
+
+static uint16_t ref_checksum(const uint8_t *buf, size_t len)
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += buf[i] | (buf[i + 1] << 8);
+    }
+    if (len & 1) {
+        sum += buf[len - 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (uint16_t)~sum;
+}
+
+static void test_reference(void)
+{
+    static uint8_t buf[MAX_LENGTH];
+    uint64_t seed = 0x5eed;
+
+    for (int round = 0; round < 2000; round++) {
+        size_t len = test_rand(&seed) % (MAX_LENGTH + 1);
+
+        for (size_t i = 0; i < len; i++) {
+            /* Mostly 0xff, so the end-around carry gets exercised */
+            buf[i] = (round & 1) ? 0xff - (test_rand(&seed) % 4) : test_rand(&seed);
+        }
+        CHECK(CbCheckSum16((UINT16 *)buf, len) == ref_checksum(buf, len));
+    }
+
+    CHECK(CbCheckSum16((UINT16 *)buf, 0) == 0xffff);
+}
+
+static void test_self_check(void)
+{
+    static uint8_t buf[MAX_LENGTH];
+    uint64_t seed = 0xc0de;
+
+    for (int round = 0; round < 2000; round++) {
+        size_t len = 2 + (test_rand(&seed) % (MAX_LENGTH - 1)) / 2 * 2;
+        size_t field = (test_rand(&seed) % (len / 2)) * 2;
+
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = test_rand(&seed);
+        }
+        buf[field] = buf[field + 1] = 0;
+
+        uint16_t sum = CbCheckSum16((UINT16 *)buf, len);
+        memcpy(&buf[field], &sum, sizeof(sum));
+        CHECK(CbCheckSum16((UINT16 *)buf, len) == 0);
+    }
+}
+
+static void bench_checksum(void)
+{
+    uint8_t *buf = malloc(BENCH_SIZE);
+    uint64_t seed = 1;
+    volatile uint16_t sink = 0;
+
+    for (size_t i = 0; i < BENCH_SIZE; i++) {
+        buf[i] = test_rand(&seed);
+    }
+
+    double start = test_seconds();
+    for (int i = 0; i < BENCH_LOOPS; i++) {
+        sink += CbCheckSum16((UINT16 *)buf, BENCH_SIZE);
+    }
+    double elapsed = test_seconds() - start;
+
+    test_log("  CbCheckSum16: %.0f MB/s\n", (double)BENCH_SIZE * BENCH_LOOPS / elapsed / 1e6);
+    (void)sink;
+    free(buf);
+}
+
+int main(void)
+{
+    test_reference();
+    test_self_check();
+    bench_checksum();
+
+    return test_report("coreboot");
+}
@@ -0,0 +1,268 @@
+/*
+ * build_e820_map() on generated UEFI memory maps: shuffled and sorted,
+ * with gaps, sub-1MiB descriptors and an odd descriptor stride, large
+ * enough to spill out of the low stub. The result must be sorted,
+ * non-overlapping, fully coalesced and cover exactly what the input did.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "test.h"
+
+#include "e820.c"
+
+/* Firmware is free to pad descriptors, OVMF uses 48 bytes */
+#define DESC_SIZE       (sizeof(EFI_MEMORY_DESCRIPTOR) + 8)
+#define LARGE_MAP       10000
+#define BENCH_LOOPS     200
+#define HIPMM_TEST_SIZE (1024 * 1024)
+
+static const EFI_MEMORY_TYPE types[] = {
+    EfiConventionalMemory, EfiBootServicesData, EfiLoaderCode,
+    EfiACPIReclaimMemory, EfiACPIMemoryNVS, EfiReservedMemoryType,
+    EfiRuntimeServicesData, EfiMemoryMappedIO,
+};
+
+static struct csmwrap_priv priv;
+static uint8_t *hipmm;
+
+static EFI_MEMORY_DESCRIPTOR *desc_at(uint8_t *map, size_t i)
+{
+    return (EFI_MEMORY_DESCRIPTOR *)(map + i * DESC_SIZE);
+}
+
+/*
+ * Back to back descriptors with occasional holes, starting below 1MiB.
+ * type_runs > 1 repeats each type so some neighbours coalesce.
+ */
+static uint8_t *make_map(size_t count, int type_runs, bool shuffle, uint64_t seed)
+{
+    uint8_t *map = calloc(count, DESC_SIZE);
+    uint64_t addr = 0x9f000;
+    EFI_MEMORY_TYPE type = EfiConventionalMemory;
+
+    for (size_t i = 0; i < count; i++) {
+        EFI_MEMORY_DESCRIPTOR *d = desc_at(map, i);
+
+        if (i % type_runs == 0) {
+            type = types[test_rand(&seed) % (sizeof(types) / sizeof(types[0]))];
+        }
+        if (test_rand(&seed) % 8 == 0) {
+            addr += EFI_PAGE_SIZE * (1 + test_rand(&seed) % 16);
+        }
+        d->Type = type;
+        d->PhysicalStart = addr;
+        d->NumberOfPages = 1 + test_rand(&seed) % 64;
+        addr += d->NumberOfPages * EFI_PAGE_SIZE;
+    }
+
+    for (size_t i = count - 1; shuffle && i > 0; i--) {
+        size_t j = test_rand(&seed) % (i + 1);
+        EFI_MEMORY_DESCRIPTOR tmp = *desc_at(map, i);
+        *desc_at(map, i) = *desc_at(map, j);
+        *desc_at(map, j) = tmp;
+    }
+
+    return map;
+}
+
+static void reset_priv(void)
+{
+    memset(priv.low_stub, 0, sizeof(*priv.low_stub));
+    priv.low_stub->init_table.HiPmmMemory = (uint32_t)(uintptr_t)hipmm;
+    priv.low_stub->init_table.HiPmmMemorySizeInBytes = HIPMM_TEST_SIZE;
+    priv.e820_map = NULL;
+    priv.e820_entries = 0;
+}
+
+/* Index of the output entry containing addr, or -1 */
+static long find_entry(uint64_t addr)
+{
+    size_t lo = 0, hi = priv.e820_entries;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        EFI_E820_ENTRY64 *e = &priv.e820_map[mid];
+
+        if (addr < e->BaseAddr) {
+            hi = mid;
+        } else if (addr >= e->BaseAddr + e->Length) {
+            lo = mid + 1;
+        } else {
+            return mid;
+        }
+    }
+    return -1;
+}
+
+static void check_map(const uint8_t *input, size_t count)
+{
+    EFI_E820_ENTRY64 *map = priv.e820_map;
+    size_t n = priv.e820_entries;
+    uint64_t covered = 0, expected = 0;
+
+    CHECK(n >= 2);
+    CHECK(map[0].BaseAddr == 0 && map[0].Length == EBDA_BASE);
+    CHECK(map[0].Type == EfiAcpiAddressRangeMemory);
+    /* Reserved memory from 1MiB up merges into the EBDA entry */
+    CHECK(map[1].BaseAddr == EBDA_BASE && map[1].BaseAddr + map[1].Length >= 0x100000);
+    CHECK(map[1].Type == EfiAcpiAddressRangeReserved);
+
+    for (size_t i = 1; i < n; i++) {
+        uint64_t prev_end = map[i - 1].BaseAddr + map[i - 1].Length;
+
+        CHECK(map[i].Length != 0);
+        CHECK(map[i].BaseAddr >= prev_end);
+        CHECK(map[i].BaseAddr != prev_end || map[i].Type != map[i - 1].Type);
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        uint64_t start = map[i].BaseAddr > 0x100000 ? map[i].BaseAddr : 0x100000;
+        uint64_t end = map[i].BaseAddr + map[i].Length;
+
+        covered += end > start ? end - start : 0;
+    }
+
+    /* Every descriptor above 1MiB sits inside one entry of its E820 type */
+    for (size_t i = 0; i < count; i++) {
+        const EFI_MEMORY_DESCRIPTOR *d = (const void *)(input + i * DESC_SIZE);
+        uint64_t start = d->PhysicalStart;
+        uint64_t end = start + d->NumberOfPages * EFI_PAGE_SIZE;
+
+        if (end <= 0x100000) {
+            continue;
+        }
+        if (start < 0x100000) {
+            start = 0x100000;
+        }
+        expected += end - start;
+
+        long idx = find_entry(start);
+        CHECK(idx >= 1);
+        if (idx >= 1) {
+            CHECK(end <= map[idx].BaseAddr + map[idx].Length);
+            CHECK(map[idx].Type == convert_memory_type(d->Type));
+        }
+    }
+
+    CHECK(covered == expected);
+}
+
+/* build_e820_map() converts in place, so it gets a copy */
+static void run_map(const uint8_t *input, size_t count)
+{
+    uint8_t *work = malloc(count * DESC_SIZE);
+
+    memcpy(work, input, count * DESC_SIZE);
+    reset_priv();
+    CHECK(build_e820_map(&priv, (EFI_MEMORY_DESCRIPTOR *)work, count * DESC_SIZE, DESC_SIZE) == 0);
+    check_map(input, count);
+    free(work);
+}
+
+static void test_generated(void)
+{
+    static const size_t sizes[] = { 1, 2, 10, 100, 125, 126, 127, 1000, LARGE_MAP };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (int runs = 1; runs <= 8; runs *= 2) {
+            for (int shuffle = 0; shuffle < 2; shuffle++) {
+                uint8_t *map = make_map(sizes[i], runs, shuffle, 0x1234 + i);
+                run_map(map, sizes[i]);
+                free(map);
+            }
+        }
+    }
+}
+
+static void test_spill(void)
+{
+    uint8_t *map = make_map(1000, 1, true, 99);
+
+    run_map(map, 1000);
+    CHECK(priv.e820_entries > E820_MAX_ENTRIES);
+    CHECK((uint8_t *)priv.e820_map >= hipmm &&
+          (uint8_t *)(priv.e820_map + priv.e820_entries) <= hipmm + HIPMM_TEST_SIZE);
+    CHECK(priv.low_stub->init_table.HiPmmMemorySizeInBytes < HIPMM_TEST_SIZE);
+    CHECK((uintptr_t)priv.e820_map ==
+          priv.low_stub->init_table.HiPmmMemory + priv.low_stub->init_table.HiPmmMemorySizeInBytes);
+    free(map);
+
+    /* What fits stays in the low stub */
+    map = make_map(100, 1, true, 98);
+    run_map(map, 100);
+    CHECK(priv.e820_map == priv.low_stub->e820_map);
+    CHECK(priv.low_stub->init_table.HiPmmMemorySizeInBytes == HIPMM_TEST_SIZE);
+    free(map);
+}
+
+static void test_overlap(void)
+{
+    uint8_t input[4 * DESC_SIZE] = { 0 };
+    EFI_MEMORY_DESCRIPTOR *d = (EFI_MEMORY_DESCRIPTOR *)input;
+
+    /* RAM 1M-2M, RAM 1.5M-3M merges, reserved 2.5M-4M is clipped to 3M-4M */
+    desc_at(input, 0)->Type = EfiConventionalMemory;
+    desc_at(input, 0)->PhysicalStart = 0x100000;
+    desc_at(input, 0)->NumberOfPages = 0x100;
+    desc_at(input, 1)->Type = EfiBootServicesData;
+    desc_at(input, 1)->PhysicalStart = 0x180000;
+    desc_at(input, 1)->NumberOfPages = 0x180;
+    desc_at(input, 2)->Type = EfiReservedMemoryType;
+    desc_at(input, 2)->PhysicalStart = 0x280000;
+    desc_at(input, 2)->NumberOfPages = 0x180;
+    /* Entirely inside the first one, dropped */
+    desc_at(input, 3)->Type = EfiACPIMemoryNVS;
+    desc_at(input, 3)->PhysicalStart = 0x110000;
+    desc_at(input, 3)->NumberOfPages = 0x10;
+
+    reset_priv();
+    CHECK(build_e820_map(&priv, d, sizeof(input), DESC_SIZE) == 0);
+    CHECK(priv.e820_entries == 4);
+    CHECK(priv.e820_map[2].BaseAddr == 0x100000 && priv.e820_map[2].Length == 0x200000);
+    CHECK(priv.e820_map[2].Type == EfiAcpiAddressRangeMemory);
+    CHECK(priv.e820_map[3].BaseAddr == 0x300000 && priv.e820_map[3].Length == 0x100000);
+    CHECK(priv.e820_map[3].Type == EfiAcpiAddressRangeReserved);
+}
+
+static void bench_large(bool shuffle)
+{
+    uint8_t *map = make_map(LARGE_MAP, 2, shuffle, 42);
+    uint8_t *work = malloc(LARGE_MAP * DESC_SIZE);
+    double elapsed = 0;
+
+    for (int i = 0; i < BENCH_LOOPS; i++) {
+        memcpy(work, map, LARGE_MAP * DESC_SIZE);
+        reset_priv();
+
+        double start = test_seconds();
+        build_e820_map(&priv, (EFI_MEMORY_DESCRIPTOR *)work, LARGE_MAP * DESC_SIZE, DESC_SIZE);
+        elapsed += test_seconds() - start;
+    }
+
+    test_log("  build_e820_map: %u %s descriptors in %.1f us\n", LARGE_MAP,
+           shuffle ? "shuffled" : "sorted", elapsed / BENCH_LOOPS * 1e6);
+    free(work);
+    free(map);
+}
+
+int main(void)
+{
+    /* The spill goes to HiPmm, which the code addresses with 32 bits */
+    hipmm = mmap(NULL, HIPMM_TEST_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (hipmm == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    priv.low_stub = calloc(1, sizeof(*priv.low_stub));
+
+    test_generated();
+    test_spill();
+    test_overlap();
+    bench_large(false);
+    bench_large(true);
+
+    return test_report("e820");
+}
@@ -0,0 +1,155 @@
+/*
+ * lz4_decompress() on a fixture compressed at build time by the same
+ * "lz4 -l" the firmware images go through, on handmade frames for the
+ * corner cases, and on every truncation and corruption of the fixture.
+ * Malformed input must be rejected without writing past dst_size.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#include "lz4.c"
+
+/* lz4_fixture_bin and lz4_fixture_bin_lz4, see the GNUmakefile */
+#include "lz4_fixture.h"
+
+#define GUARD       0xa5
+#define GUARD_SIZE  64
+#define BENCH_LOOPS 2000
+
+static uint8_t *out_buf;
+
+/* Decompress into a guarded buffer, and check nothing past dst_size changed */
+static size_t decompress(size_t dst_size, const uint8_t *src, size_t src_size)
+{
+    memset(out_buf, GUARD, dst_size + GUARD_SIZE);
+    size_t ret = lz4_decompress(out_buf, dst_size, src, src_size);
+
+    for (size_t i = dst_size; i < dst_size + GUARD_SIZE; i++) {
+        CHECK(out_buf[i] == GUARD);
+    }
+    CHECK(ret <= dst_size);
+    return ret;
+}
+
+static void test_fixture(void)
+{
+    size_t size = lz4_fixture_bin_len;
+
+    CHECK(decompress(size, lz4_fixture_bin_lz4, lz4_fixture_bin_lz4_len) == size);
+    CHECK(memcmp(out_buf, lz4_fixture_bin, size) == 0);
+
+    /* Room to spare is fine, one byte short is not */
+    CHECK(decompress(size + 100, lz4_fixture_bin_lz4, lz4_fixture_bin_lz4_len) == size);
+    CHECK(decompress(size - 1, lz4_fixture_bin_lz4, lz4_fixture_bin_lz4_len) == 0);
+}
+
+static void test_truncated(void)
+{
+    size_t size = lz4_fixture_bin_len;
+
+    for (size_t len = 0; len < lz4_fixture_bin_lz4_len; len++) {
+        CHECK(decompress(size, lz4_fixture_bin_lz4, len) != size);
+    }
+}
+
+static void test_corrupted(void)
+{
+    size_t size = lz4_fixture_bin_len;
+    size_t len = lz4_fixture_bin_lz4_len;
+    uint8_t *src = malloc(len);
+    uint64_t seed = 7;
+
+    /* Any outcome but an overflow is fine, the caller checks the size */
+    for (int round = 0; round < 20000; round++) {
+        memcpy(src, lz4_fixture_bin_lz4, len);
+        src[test_rand(&seed) % len] ^= 1 + test_rand(&seed) % 255;
+        decompress(size, src, len);
+    }
+
+    free(src);
+}
+
+static void test_handmade(void)
+{
+    /* 'a', then a 1000 byte match at offset 1 with a 255-continued length, then 'b' */
+    static const uint8_t run[] = {
+        0x02, 0x21, 0x4c, 0x18, 10, 0, 0, 0,
+        0x1f, 'a', 0x01, 0x00, 0xff, 0xff, 0xff, 0xd8,
+        0x10, 'b',
+    };
+    CHECK(decompress(1002, run, sizeof(run)) == 1002);
+    for (size_t i = 0; i < 1001; i++) {
+        CHECK(out_buf[i] == 'a');
+    }
+    CHECK(out_buf[1001] == 'b');
+    CHECK(decompress(1001, run, sizeof(run)) == 0);
+
+    /* Two frames back to back decode one after the other */
+    static const uint8_t frames[] = {
+        0x02, 0x21, 0x4c, 0x18, 3, 0, 0, 0, 0x20, 'h', 'i',
+        0x02, 0x21, 0x4c, 0x18, 2, 0, 0, 0, 0x10, '!',
+    };
+    CHECK(decompress(3, frames, sizeof(frames)) == 3);
+    CHECK(memcmp(out_buf, "hi!", 3) == 0);
+
+    /* A match reaching back before the start of the block */
+    static const uint8_t far[] = {
+        0x02, 0x21, 0x4c, 0x18, 6, 0, 0, 0, 0x10, 'a', 0x02, 0x00, 0x00, 0x00,
+    };
+    CHECK(decompress(64, far, sizeof(far)) == 0);
+
+    /* Offset 0 is invalid */
+    static const uint8_t zero[] = {
+        0x02, 0x21, 0x4c, 0x18, 6, 0, 0, 0, 0x10, 'a', 0x00, 0x00, 0x00, 0x00,
+    };
+    CHECK(decompress(64, zero, sizeof(zero)) == 0);
+
+    /* Literal run longer than the block */
+    static const uint8_t literals[] = {
+        0x02, 0x21, 0x4c, 0x18, 3, 0, 0, 0, 0x50, 'a', 'b',
+    };
+    CHECK(decompress(64, literals, sizeof(literals)) == 0);
+
+    /* Block size past the end of the input */
+    static const uint8_t block[] = {
+        0x02, 0x21, 0x4c, 0x18, 9, 0, 0, 0, 0x20, 'h', 'i',
+    };
+    CHECK(decompress(64, block, sizeof(block)) == 0);
+
+    /* The modern frame format is not what the build produces */
+    static const uint8_t modern[] = {
+        0x04, 0x22, 0x4d, 0x18, 0x64, 0x40, 0xa7, 0, 0, 0, 0,
+    };
+    CHECK(decompress(64, modern, sizeof(modern)) == 0);
+}
+
+static void bench_fixture(void)
+{
+    size_t size = lz4_fixture_bin_len;
+    double start = test_seconds();
+
+    for (int i = 0; i < BENCH_LOOPS; i++) {
+        lz4_decompress(out_buf, size, lz4_fixture_bin_lz4, lz4_fixture_bin_lz4_len);
+    }
+    double elapsed = test_seconds() - start;
+
+    test_log("  lz4_decompress: %.0f MB/s, ratio %.2f\n",
+           (double)size * BENCH_LOOPS / elapsed / 1e6,
+           (double)lz4_fixture_bin_lz4_len / size);
+}
+
+int main(void)
+{
+    out_buf = malloc(lz4_fixture_bin_len + 2048 + GUARD_SIZE);
+
+    test_fixture();
+    test_truncated();
+    test_corrupted();
+    test_handmade();
+    bench_fixture();
+
+    free(out_buf);
+    return test_report("lz4");
+}